@@ -0,0 +1,141 @@
+/*****************************************************************************
+ **
+ ** aimd.c
+ **
+ ** Function implementations for the verifier's adaptive concurrency control
+ **
+ ** An epoch lasts until one window's worth of requests has completed, which
+ ** is roughly one round trip. At the end of each epoch the window is:
+ **   - halved if any request failed or the mean latency rose more than
+ **     LATENCY_TOLERANCE above the uncongested (base) latency;
+ **   - doubled during slow start, otherwise grown by one, if throughput did
+ **     not fall;
+ **   - left alone otherwise.
+ ** Requests that were already in flight when the window was cut still carry
+ ** the old congestion, so epochs containing them never cut it again.
+ ** The base latency is the lowest epoch mean seen in the last
+ ** BASE_LATENCY_LIFETIME_US, so the controller follows a service whose
+ ** capacity changes over time. It is kept as the minimum of each of
+ ** BASE_LATENCY_SLOTS equal slots of that lifetime, so it is a true sliding
+ ** minimum however many epochs there are, and high latency can only raise it
+ ** once every lower epoch has aged out.
+ **
+ ****************************************************************************/
+
+#include "aimd.h"
+
+#define LATENCY_TOLERANCE 1.5
+#define THROUGHPUT_TOLERANCE 0.95
+#define DECREASE_FACTOR 0.5
+#define BASE_LATENCY_LIFETIME_US 10000000L
+
+/* Record an epoch's mean latency and recompute the base from the slots that
+ * are still within the lifetime; the current slot always is */
+static void update_base_latency(aimd_controller *ctl, double mean_latency_ms, long now_us) {
+    latency_slot *current = &ctl->base_slots[ctl->base_slot];
+    if (current->min_ms < 0 || now_us - current->start_us >= BASE_LATENCY_LIFETIME_US / BASE_LATENCY_SLOTS) {
+        ctl->base_slot = (ctl->base_slot + 1) % BASE_LATENCY_SLOTS;
+        current = &ctl->base_slots[ctl->base_slot];
+        current->start_us = now_us;
+        current->min_ms = mean_latency_ms;
+    } else if (mean_latency_ms < current->min_ms) {
+        current->min_ms = mean_latency_ms;
+    }
+
+    ctl->base_latency_ms = current->min_ms;
+    ctl->base_latency_time_us = current->start_us;
+    for (int i = 0; i < BASE_LATENCY_SLOTS; i++) {
+        latency_slot *slot = &ctl->base_slots[i];
+        if (slot->min_ms >= 0 && now_us - slot->start_us < BASE_LATENCY_LIFETIME_US
+            && slot->min_ms < ctl->base_latency_ms) {
+            ctl->base_latency_ms = slot->min_ms;
+            ctl->base_latency_time_us = slot->start_us;
+        }
+    }
+}
+
+void aimd_init(aimd_controller *ctl, int enabled, int max_window, long now_us, FILE *log) {
+    ctl->enabled = enabled;
+    ctl->max_window = max_window;
+    ctl->window = enabled ? 1 : max_window;
+    ctl->slow_start = 1;
+    ctl->base_latency_ms = -1;
+    ctl->base_latency_time_us = now_us;
+    for (int i = 0; i < BASE_LATENCY_SLOTS; i++) {
+        ctl->base_slots[i].start_us = now_us;
+        ctl->base_slots[i].min_ms = -1;
+    }
+    ctl->base_slot = 0;
+    ctl->start_us = now_us;
+    ctl->epoch_start_us = now_us;
+    ctl->epoch_completed = 0;
+    ctl->epoch_errors = 0;
+    ctl->epoch_latency_sum_ms = 0;
+    ctl->last_throughput = 0;
+    ctl->num_started = 0;
+    ctl->recovery_seq = 0;
+    ctl->epoch_stale = 0;
+    ctl->log = log;
+}
+
+long aimd_on_start(aimd_controller *ctl) {
+    return ++ctl->num_started;
+}
+
+void aimd_on_complete(aimd_controller *ctl, long seq, double latency_ms, int failed, long now_us) {
+    if (!ctl->enabled) {
+        return;
+    }
+    ctl->epoch_stale |= seq <= ctl->recovery_seq;
+    ctl->epoch_completed++;
+    ctl->epoch_errors += failed;
+    ctl->epoch_latency_sum_ms += latency_ms;
+    if (ctl->epoch_completed < (int) ctl->window) {
+        return;
+    }
+
+    double mean_latency_ms = ctl->epoch_latency_sum_ms / ctl->epoch_completed;
+    long elapsed_us = now_us - ctl->epoch_start_us;
+    double throughput = ctl->epoch_completed * 1000000.0 / (elapsed_us > 0 ? elapsed_us : 1);
+
+    update_base_latency(ctl, mean_latency_ms, now_us);
+
+    const char *action;
+    if (ctl->epoch_stale) {
+        action = "recovery";
+    } else if (ctl->epoch_errors > 0 || mean_latency_ms > ctl->base_latency_ms * LATENCY_TOLERANCE) {
+        ctl->window *= DECREASE_FACTOR;
+        if (ctl->window < 1) {
+            ctl->window = 1;
+        }
+        ctl->slow_start = 0;
+        ctl->recovery_seq = ctl->num_started;
+        action = "decrease";
+    } else if (throughput >= ctl->last_throughput * THROUGHPUT_TOLERANCE) {
+        ctl->window = ctl->slow_start ? ctl->window * 2 : ctl->window + 1;
+        if (ctl->window > ctl->max_window) {
+            ctl->window = ctl->max_window;
+        }
+        action = ctl->slow_start ? "slow start" : "increase";
+    } else {
+        action = "hold";
+    }
+
+    if (ctl->log != NULL) {
+        fprintf(ctl->log, "aimd: %8.3f s window %4d (%s) %9.1f req/s latency %7.2f ms base %7.2f ms (%4.1f s old) errors %d\n",
+                (now_us - ctl->start_us) / 1000000.0, (int) ctl->window, action, throughput,
+                mean_latency_ms, ctl->base_latency_ms, (now_us - ctl->base_latency_time_us) / 1000000.0,
+                ctl->epoch_errors);
+    }
+
+    ctl->last_throughput = throughput;
+    ctl->epoch_start_us = now_us;
+    ctl->epoch_completed = 0;
+    ctl->epoch_errors = 0;
+    ctl->epoch_latency_sum_ms = 0;
+    ctl->epoch_stale = 0;
+}
+
+int aimd_window(aimd_controller *ctl) {
+    return (int) ctl->window;
+}
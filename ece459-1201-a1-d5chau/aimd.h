@@ -0,0 +1,51 @@
+/*****************************************************************************
+ **
+ ** aimd.h
+ **
+ ** Adaptive concurrency control for the verifier, in the style of TCP
+ ** congestion control: the in-flight window doubles while the service keeps
+ ** up (slow start), then grows by one request per round trip, and halves on
+ ** a latency spike or a failed request.
+ **
+ ****************************************************************************/
+
+#include <stdio.h>
+
+#ifndef AIMD_H
+#define AIMD_H
+
+#define BASE_LATENCY_SLOTS 10
+
+/* Lowest epoch mean latency among the epochs that ended in one slot of time */
+typedef struct {
+    long start_us;
+    double min_ms;              /* -1 while the slot is unused */
+} latency_slot;
+
+typedef struct {
+    int enabled;
+    double window;              /* Requests allowed in flight */
+    int max_window;
+    int slow_start;             /* Doubling until the first congestion signal */
+    double base_latency_ms;     /* Lowest epoch latency seen recently */
+    long base_latency_time_us;  /* Start of the slot base_latency_ms comes from */
+    latency_slot base_slots[BASE_LATENCY_SLOTS]; /* Ring of recent minima */
+    int base_slot;              /* The slot epochs are ending in now */
+    long start_us;
+    long epoch_start_us;
+    int epoch_completed;
+    int epoch_errors;
+    double epoch_latency_sum_ms;
+    double last_throughput;
+    long num_started;           /* Sequence number of the last request started */
+    long recovery_seq;          /* Requests up to here predate the last decrease */
+    int epoch_stale;            /* Epoch saw requests sent before the decrease */
+    FILE *log;
+} aimd_controller;
+
+extern void aimd_init(aimd_controller *ctl, int enabled, int max_window, long now_us, FILE *log);
+extern long aimd_on_start(aimd_controller *ctl);
+extern void aimd_on_complete(aimd_controller *ctl, long seq, double latency_ms, int failed, long now_us);
+extern int aimd_window(aimd_controller *ctl);
+
+#endif
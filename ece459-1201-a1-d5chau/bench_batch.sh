@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Sweep the batch size (-b) against the connection count (-t) of
+# verifier_multi, running against a local verify_server, and print one CSV
+# row per combination.
+#
+# Usage: ./bench_batch.sh <solved puzzles file> [batch sizes] [connection counts]
+# e.g.   ./bench_batch.sh output.txt "1 4 16 64 256" "1 4 16 64 256"
+
+INPUT=${1:?usage: $0 <solved puzzles file> [batch sizes] [connection counts]}
+BATCH_SIZES=${2:-"1 4 16 64 256"}
+CONNECTIONS=${3:-"1 4 16 64 256"}
+PORT=${PORT:-4590}
+URL="http://127.0.0.1:${PORT}/verify"
+BIN=$(dirname "$0")/bin
+
+if [ ! -x "$BIN/verifier_multi" ] || [ ! -x "$BIN/verify_server" ]; then
+    echo "Build first: make checker" >&2
+    exit 1
+fi
+
+"$BIN/verify_server" -p "$PORT" > /dev/null &
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2> /dev/null' EXIT
+sleep 0.5
+if ! kill -0 $SERVER_PID 2> /dev/null; then
+    echo "verify_server failed to start on port $PORT" >&2
+    exit 1
+fi
+
+echo "batch_size,connections,puzzles,seconds,puzzles_per_second"
+for b in $BATCH_SIZES; do
+    for t in $CONNECTIONS; do
+        start=$(date +%s%N)
+        summary=$("$BIN/verifier_multi" -b "$b" -t "$t" -u "$URL" -i "$INPUT" 2> /dev/null | tail -n 1)
+        end=$(date +%s%N)
+        puzzles=$(echo "$summary" | awk '{print $3}')
+        awk -v b="$b" -v t="$t" -v p="$puzzles" -v ns=$((end - start)) \
+            'BEGIN { s = ns / 1e9; printf "%d,%d,%d,%.3f,%.1f\n", b, t, p, s, p / s }'
+    done
+done
@@ -0,0 +1,160 @@
+/*****************************************************************************
+ **
+ ** cache.c
+ **
+ ** Function implementations for the verification result cache
+ **
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "cache.h"
+
+#define INITIAL_CAPACITY 1024
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+uint64_t grid_hash(puzzle *p) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (int i = 0; i < 9; i++) {
+        for (int j = 0; j < 9; j++) {
+            hash ^= (uint64_t) p->content[i][j];
+            hash *= FNV_PRIME;
+        }
+    }
+    /* 0 is reserved for empty buckets */
+    return hash != 0 ? hash : 1;
+}
+
+verify_cache *cache_create() {
+    verify_cache *cache = malloc(sizeof(verify_cache));
+    cache->capacity = INITIAL_CAPACITY;
+    cache->size = 0;
+    cache->keys = calloc(cache->capacity, sizeof(uint64_t));
+    cache->verdicts = calloc(cache->capacity, sizeof(unsigned char));
+    cache->hits = 0;
+    cache->misses = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+/* Bucket holding the key, or the empty bucket where it belongs */
+static size_t find_bucket(verify_cache *cache, uint64_t key) {
+    size_t mask = cache->capacity - 1;
+    size_t i = (size_t) (key ^ (key >> 32)) & mask;
+    while (cache->keys[i] != 0 && cache->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Double the table once it is half full; the caller holds the lock */
+static void grow(verify_cache *cache) {
+    uint64_t *old_keys = cache->keys;
+    unsigned char *old_verdicts = cache->verdicts;
+    size_t old_capacity = cache->capacity;
+
+    cache->capacity *= 2;
+    cache->keys = calloc(cache->capacity, sizeof(uint64_t));
+    cache->verdicts = calloc(cache->capacity, sizeof(unsigned char));
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_keys[i] != 0) {
+            size_t j = find_bucket(cache, old_keys[i]);
+            cache->keys[j] = old_keys[i];
+            cache->verdicts[j] = old_verdicts[i];
+        }
+    }
+    free(old_keys);
+    free(old_verdicts);
+}
+
+/*
+ * Returns the cached verdict (0 or 1) for the key, or -1 on a miss
+ */
+int cache_lookup(verify_cache *cache, uint64_t key) {
+    pthread_mutex_lock(&cache->lock);
+    size_t i = find_bucket(cache, key);
+    int verdict = -1;
+    if (cache->keys[i] == key) {
+        verdict = cache->verdicts[i];
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return verdict;
+}
+
+void cache_insert(verify_cache *cache, uint64_t key, int verdict) {
+    pthread_mutex_lock(&cache->lock);
+    if (2 * (cache->size + 1) > cache->capacity) {
+        grow(cache);
+    }
+    size_t i = find_bucket(cache, key);
+    if (cache->keys[i] == 0) {
+        cache->keys[i] = key;
+        cache->size++;
+    }
+    cache->verdicts[i] = (unsigned char) verdict;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Add the entries of a saved cache; returns the number loaded, or -1 if
+ * the file cannot be opened
+ */
+long cache_load(verify_cache *cache, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    unsigned long long key;
+    int verdict;
+    long loaded = 0;
+    while (fscanf(file, "%llx %d\n", &key, &verdict) == 2) {
+        if (key != 0 && (verdict == 0 || verdict == 1)) {
+            cache_insert(cache, (uint64_t) key, verdict);
+            loaded++;
+        }
+    }
+    fclose(file);
+    return loaded;
+}
+
+/*
+ * Write every entry to the file, replacing it; returns the number saved,
+ * or -1 if the file cannot be written
+ */
+long cache_save(verify_cache *cache, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    long saved = 0;
+    pthread_mutex_lock(&cache->lock);
+    for (size_t i = 0; i < cache->capacity; i++) {
+        if (cache->keys[i] != 0) {
+            fprintf(file, "%016llx %d\n", (unsigned long long) cache->keys[i], cache->verdicts[i]);
+            saved++;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (fclose(file) != 0) {
+        return -1;
+    }
+    return saved;
+}
+
+void cache_print(verify_cache *cache, FILE *out) {
+    uint64_t lookups = cache->hits + cache->misses;
+    fprintf(out, "    cache: %llu hits, %llu misses (%.1f%% hit rate), %llu entries\n",
+            (unsigned long long) cache->hits, (unsigned long long) cache->misses,
+            lookups > 0 ? 100.0 * cache->hits / lookups : 0.0, (unsigned long long) cache->size);
+}
+
+void cache_delete(verify_cache *cache) {
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->keys);
+    free(cache->verdicts);
+    free(cache);
+}
@@ -0,0 +1,39 @@
+/*****************************************************************************
+ **
+ ** cache.h
+ **
+ ** Verification results keyed by a 64-bit FNV-1a hash of the grid's 81
+ ** digits. Open addressing with linear probing; one mutex guards the table
+ ** so verifier shards can share it. The table can be loaded from and saved
+ ** to a text file of "<hash> <verdict>" lines.
+ **
+ ****************************************************************************/
+
+#include <stdint.h>
+#include <pthread.h>
+#include "common.h"
+
+#ifndef CACHE_H
+#define CACHE_H
+
+typedef struct {
+    uint64_t *keys;         /* 0 marks an empty bucket */
+    unsigned char *verdicts;
+    size_t capacity;        /* Power of two */
+    size_t size;
+    uint64_t hits;
+    uint64_t misses;
+    pthread_mutex_t lock;
+} verify_cache;
+
+extern uint64_t grid_hash(puzzle *p);
+
+extern verify_cache *cache_create();
+extern int cache_lookup(verify_cache *cache, uint64_t key);
+extern void cache_insert(verify_cache *cache, uint64_t key, int verdict);
+extern long cache_load(verify_cache *cache, const char *path);
+extern long cache_save(verify_cache *cache, const char *path);
+extern void cache_print(verify_cache *cache, FILE *out);
+extern void cache_delete(verify_cache *cache);
+
+#endif
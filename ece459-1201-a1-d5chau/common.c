@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include "common.h"
 
@@ -23,17 +24,16 @@ int init_locks() {
 }
 
 /*
- * Function to read the next available puzzle from file
+ * Function to read the next available puzzle from file into a caller-owned
+ * puzzle; returns 1 if a puzzle was read, 0 on EOF
  */ 
-puzzle *read_next_puzzle(FILE *inputfile) {
-    puzzle *p = malloc(sizeof(puzzle));
+int read_puzzle(FILE *inputfile, puzzle *p) {
     char temp[10];
     for (int i = 0; i < 9; i++) {
         int read = fscanf(inputfile, "%9c\n", temp);
         if (read != 1) {
             /* Reached EOF */
-            free(p);
-            return NULL;
+            return 0;
         }
         for (int j = 0; j < 9; j++) {
             p->content[i][j] = temp[j] == '.'
@@ -41,6 +41,18 @@ puzzle *read_next_puzzle(FILE *inputfile) {
                                : temp[j] - '0';
         }
     }
+    return 1;
+}
+
+/*
+ * Function to read the next available puzzle from file
+ */ 
+puzzle *read_next_puzzle(FILE *inputfile) {
+    puzzle *p = malloc(sizeof(puzzle));
+    if (!read_puzzle(inputfile, p)) {
+        free(p);
+        return NULL;
+    }
     return p;
 }
 
@@ -54,6 +66,20 @@ puzzle *read_next_puzzle_with_lock(FILE *inputfile) {
     return p;
 }
 
+/*
+ * Read up to max_puzzles puzzles in a single critical section, so threads
+ * taking whole batches do not interleave; returns the number read
+ */
+int read_puzzles_with_lock(FILE *inputfile, puzzle *puzzles, int max_puzzles) {
+    int num_read = 0;
+    pthread_mutex_lock(&read_lock);
+    while (num_read < max_puzzles && read_puzzle(inputfile, &puzzles[num_read])) {
+        num_read++;
+    }
+    pthread_mutex_unlock(&read_lock);
+    return num_read;
+}
+
 /*
  * Function to write a given puzzle to file
  */ 
@@ -90,4 +116,129 @@ void *print_puzzle(puzzle *p) {
         printf("\n");
     }
     printf("\n");
-}
\ No newline at end of file
+}
+
+/*
+ * Checks that every row, column and 3x3 sector of the puzzle holds each of
+ * the digits 1 to 9 exactly once; returns 1 if so, 0 if not
+ */
+int is_solved(puzzle *p) {
+    for (int i = 0; i < 9; i++) {
+        int row_seen = 0;
+        int column_seen = 0;
+        int sector_seen = 0;
+        for (int j = 0; j < 9; j++) {
+            int r = p->content[i][j];
+            int c = p->content[j][i];
+            int s = p->content[3 * (i / 3) + j / 3][3 * (i % 3) + j % 3];
+            if (r < 1 || r > 9 || c < 1 || c > 9 || s < 1 || s > 9) {
+                return 0;
+            }
+            row_seen |= 1 << r;
+            column_seen |= 1 << c;
+            sector_seen |= 1 << s;
+        }
+        if (row_seen != 0x3FE || column_seen != 0x3FE || sector_seen != 0x3FE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Write the grid template "[[0,0,...], ..., [0,...]]" (GRID_JSON_LENGTH bytes)
+ */
+static void init_grid_json(char *grid) {
+    char *out = grid;
+    *out++ = '[';
+    for (int i = 0; i < 9; i++) {
+        if (i > 0) {
+            *out++ = ',';
+            *out++ = ' ';
+        }
+        *out++ = '[';
+        for (int j = 0; j < 9; j++) {
+            if (j > 0) {
+                *out++ = ',';
+            }
+            *out++ = '0';
+        }
+        *out++ = ']';
+    }
+    *out = ']';
+}
+
+/*
+ * Write the {"content":...} template into a buffer of PUZZLE_JSON_LENGTH + 1
+ * bytes; it stays valid across any number of `encode_grid_json` calls
+ */
+void init_puzzle_json(char *buffer) {
+    memcpy(buffer, "{\"content\":", 11);
+    init_grid_json(PUZZLE_JSON_GRID(buffer));
+    buffer[PUZZLE_JSON_LENGTH - 1] = '}';
+    buffer[PUZZLE_JSON_LENGTH] = '\0';
+}
+
+/*
+ * Write the {"batch":[...]} template for up to max_grids grids into a buffer
+ * of BATCH_JSON_LENGTH(max_grids) + 1 bytes
+ */
+void init_batch_json(char *buffer, int max_grids) {
+    memcpy(buffer, "{\"batch\":[", 10);
+    for (int k = 0; k < max_grids; k++) {
+        init_grid_json(BATCH_JSON_GRID(buffer, k));
+    }
+    close_batch_json(buffer, max_grids);
+    buffer[BATCH_JSON_LENGTH(max_grids)] = '\0';
+}
+
+/*
+ * Overwrite the 81 digits of a grid template with the puzzle's contents
+ */
+void encode_grid_json(puzzle *p, char *grid) {
+    for (int i = 0; i < 9; i++) {
+        for (int j = 0; j < 9; j++) {
+            grid[GRID_JSON_DIGIT_OFFSET(i, j)] = (char) ('0' + p->content[i][j]);
+        }
+    }
+}
+
+/*
+ * End a batch body after num_grids grids; returns the body length. The
+ * separators are rewritten each time because a shorter batch overwrites them
+ */
+size_t close_batch_json(char *buffer, int num_grids) {
+    for (int k = 1; k < num_grids; k++) {
+        char *grid = BATCH_JSON_GRID(buffer, k);
+        grid[-1] = ',';
+        grid[0] = '[';
+    }
+    char *end = BATCH_JSON_GRID(buffer, num_grids) - 1;
+    end[0] = ']';
+    end[1] = '}';
+    return BATCH_JSON_LENGTH(num_grids);
+}
+
+/*
+ * Count the verified grids in a {"batch":...} response, "[1,0,...]", and
+ * store each grid's verdict if verdicts is not NULL; returns -1 if it is
+ * malformed or does not cover num_puzzles grids
+ */
+int parse_batch_response(const char *response, int num_puzzles, unsigned char *verdicts) {
+    const char *cursor = strchr(response, '[');
+    int count = 0;
+    int verified = 0;
+    if (cursor == NULL) {
+        return -1;
+    }
+    for (cursor++; *cursor != '\0' && *cursor != ']'; cursor++) {
+        if (*cursor == '0' || *cursor == '1') {
+            if (verdicts != NULL && count < num_puzzles) {
+                verdicts[count] = *cursor - '0';
+            }
+            verified += *cursor - '0';
+            count++;
+        }
+    }
+    return count == num_puzzles ? verified : -1;
+}
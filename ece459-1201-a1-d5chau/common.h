@@ -27,6 +27,17 @@ typedef struct {
     int *solve_complete_flag_ptr;
 } sudoku_workers_input;
 
+typedef struct {
+    FILE *input_file;
+    Queue *input_queue;         /* Unsolved puzzles, reader to solvers */
+    Queue *output_queue;        /* Solved puzzles, solvers to verifiers */
+    const char *url;            /* Verification endpoint; NULL to check locally */
+    int batch_size;             /* Grids per verification request */
+    int num_read;               /* Set by the reader */
+    int num_verified;           /* Set by each verifier */
+    int num_checked;
+} sudoku_pipeline_input;
+
 typedef struct {
     Queue *puzzle_queue;
     FILE *output_file;
@@ -34,14 +45,40 @@ typedef struct {
     int *no_more_puzzles_flag_ptr;
 } sudoku_multi_input;
 
+/*
+ * Fixed JSON templates for the verification requests. A grid is encoded as
+ * "[[d,d,d,d,d,d,d,d,d], [d,...], ...]", so every digit sits at a known offset
+ * and encoding a puzzle only has to overwrite those 81 bytes.
+ */
+#define GRID_JSON_LENGTH 189
+#define GRID_JSON_DIGIT_OFFSET(row, column) (2 + 21 * (row) + 2 * (column))
+
+/* {"content":<grid>} */
+#define PUZZLE_JSON_LENGTH (11 + GRID_JSON_LENGTH + 1)
+#define PUZZLE_JSON_GRID(buffer) ((buffer) + 11)
+
+/* {"batch":[<grid>,<grid>,...]} */
+#define BATCH_JSON_LENGTH(num_grids) (11 + (GRID_JSON_LENGTH + 1) * (num_grids))
+#define BATCH_JSON_GRID(buffer, k) ((buffer) + 10 + (GRID_JSON_LENGTH + 1) * (k))
+
 int init_locks();
 
+int read_puzzle(FILE *inputfile, puzzle *p);
 puzzle *read_next_puzzle(FILE *inputfile);
 puzzle *read_next_puzzle_with_lock(FILE *inputfile);
+int read_puzzles_with_lock(FILE *inputfile, puzzle *puzzles, int max_puzzles);
 
 void write_to_file(puzzle *p, FILE *outputfile);
 void write_to_file_with_lock(puzzle *p, FILE *outputfile);
 
 void *print_puzzle(puzzle *p);
 
+int is_solved(puzzle *p);
+
+void init_puzzle_json(char *buffer);
+void init_batch_json(char *buffer, int max_grids);
+void encode_grid_json(puzzle *p, char *grid);
+size_t close_batch_json(char *buffer, int num_grids);
+int parse_batch_response(const char *response, int num_puzzles, unsigned char *verdicts);
+
 #endif //SUDOKU_COMMON_H
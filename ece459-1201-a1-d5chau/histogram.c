@@ -0,0 +1,83 @@
+/*****************************************************************************
+ **
+ ** histogram.c
+ **
+ ** Function implementations for the log-linear latency histogram
+ **
+ ****************************************************************************/
+
+#include <string.h>
+#include "histogram.h"
+
+/* Bucket holding a value; buckets are contiguous across powers of two */
+static int bucket_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return (int) value;
+    }
+    int shift = (63 - __builtin_clzll(value)) - HISTOGRAM_SUB_BITS + 1;
+    return shift * HISTOGRAM_HALF_COUNT + (int) (value >> shift);
+}
+
+/* Largest value that lands in a bucket */
+static uint64_t bucket_upper_bound(int index) {
+    if (index < HISTOGRAM_SUB_COUNT) {
+        return (uint64_t) index;
+    }
+    int shift = index / HISTOGRAM_HALF_COUNT - 1;
+    uint64_t sub = (uint64_t) (index - shift * HISTOGRAM_HALF_COUNT);
+    return ((sub + 1) << shift) - 1;
+}
+
+void histogram_reset(histogram *h) {
+    memset(h, 0, sizeof(histogram));
+}
+
+void histogram_record(histogram *h, uint64_t value) {
+    h->counts[bucket_index(value)]++;
+    if (h->total == 0 || value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+    h->total++;
+}
+
+void histogram_merge(histogram *dst, const histogram *src) {
+    if (src->total == 0) {
+        return;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    if (dst->total == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    dst->total += src->total;
+}
+
+/*
+ * Smallest recorded value v such that at least `percentile` percent of the
+ * recorded values are <= v, reported as its bucket's upper bound
+ */
+uint64_t histogram_percentile(const histogram *h, double percentile) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t wanted = (uint64_t) (percentile / 100.0 * h->total + 0.5);
+    if (wanted < 1) {
+        wanted = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= wanted) {
+            uint64_t value = bucket_upper_bound(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
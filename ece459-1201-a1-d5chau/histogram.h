@@ -0,0 +1,34 @@
+/*****************************************************************************
+ **
+ ** histogram.h
+ **
+ ** A log-linear histogram in the style of HdrHistogram: values below
+ ** 2^HISTOGRAM_SUB_BITS are counted exactly, larger values in buckets whose
+ ** width doubles with each power of two, so every recorded value is kept to
+ ** within 1 / 2^(HISTOGRAM_SUB_BITS - 1) of its true value (under 2%).
+ **
+ ****************************************************************************/
+
+#include <stdint.h>
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_HALF_COUNT (HISTOGRAM_SUB_COUNT / 2)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_HALF_COUNT)
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} histogram;
+
+extern void histogram_reset(histogram *h);
+extern void histogram_record(histogram *h, uint64_t value);
+extern void histogram_merge(histogram *dst, const histogram *src);
+extern uint64_t histogram_percentile(const histogram *h, double percentile);
+
+#endif
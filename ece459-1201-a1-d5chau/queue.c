@@ -14,17 +14,24 @@
 #include "queue.h"
 
 Queue* Queue_init() {
+    return Queue_init_bounded(0);
+}
+
+Queue* Queue_init_bounded(unsigned capacity) {
     Queue *q = (Queue*) malloc(sizeof(Queue));
     q->size = 0;
+    q->capacity = capacity;
+    q->closed = 0;
     q->head = NULL;
     q->tail = NULL;
     pthread_mutex_init(&(q->lock), NULL);
+    pthread_cond_init(&(q->not_empty), NULL);
+    pthread_cond_init(&(q->not_full), NULL);
     return q;
 }
 
-void Queue_add(Queue *q, void *el) {
-    pthread_mutex_lock(&(q->lock));
-    Node *temp = q->head;
+/* Append to the tail; the caller holds the lock */
+static void append_locked(Queue *q, void *el) {
     Node *new_tail = malloc(sizeof(Node));
     new_tail->val = el;
     new_tail->next = NULL;
@@ -37,12 +44,11 @@ void Queue_add(Queue *q, void *el) {
 
     q->tail = new_tail;
     q->size++;
-    pthread_mutex_unlock(&(q->lock));
+    pthread_cond_signal(&(q->not_empty));
 }
 
-void* Queue_remove(Queue *q) {
-    pthread_mutex_lock(&(q->lock));
-    assert(q && q->size > 0);
+/* Detach the head; the caller holds the lock and the queue is not empty */
+static void* remove_locked(Queue *q) {
     Node *head = q->head;
     void *headval = head->val;
     q->head = head->next;
@@ -53,10 +59,74 @@ void* Queue_remove(Queue *q) {
 
     q->size--;
     free(head);
+    pthread_cond_signal(&(q->not_full));
+    return (headval);
+}
+
+void Queue_add(Queue *q, void *el) {
+    pthread_mutex_lock(&(q->lock));
+    append_locked(q, el);
+    pthread_mutex_unlock(&(q->lock));
+}
+
+void* Queue_remove(Queue *q) {
+    pthread_mutex_lock(&(q->lock));
+    assert(q && q->size > 0);
+    void *headval = remove_locked(q);
     pthread_mutex_unlock(&(q->lock));
     return (headval);
 }
 
+/*
+ * Append an element, waiting while a bounded queue is full
+ */
+void Queue_put(Queue *q, void *el) {
+    pthread_mutex_lock(&(q->lock));
+    while (q->capacity > 0 && q->size >= q->capacity) {
+        pthread_cond_wait(&(q->not_full), &(q->lock));
+    }
+    append_locked(q, el);
+    pthread_mutex_unlock(&(q->lock));
+}
+
+/*
+ * Remove the head, waiting while the queue is empty; returns NULL once the
+ * queue is closed and drained
+ */
+void* Queue_take(Queue *q) {
+    void *el = NULL;
+    Queue_take_many(q, &el, 1);
+    return el;
+}
+
+/*
+ * Wait for at least one element, then remove up to max_els without waiting
+ * for more; returns the number removed, 0 once the queue is closed and
+ * drained
+ */
+int Queue_take_many(Queue *q, void **els, int max_els) {
+    int taken = 0;
+    pthread_mutex_lock(&(q->lock));
+    while (q->size == 0 && !q->closed) {
+        pthread_cond_wait(&(q->not_empty), &(q->lock));
+    }
+    while (taken < max_els && q->size > 0) {
+        els[taken++] = remove_locked(q);
+    }
+    pthread_mutex_unlock(&(q->lock));
+    return taken;
+}
+
+/*
+ * Mark the queue as finished and wake every waiting consumer
+ */
+void Queue_close(Queue *q) {
+    pthread_mutex_lock(&(q->lock));
+    q->closed = 1;
+    pthread_cond_broadcast(&(q->not_empty));
+    pthread_mutex_unlock(&(q->lock));
+}
+
 int Queue_size(Queue *q) {
     pthread_mutex_lock(&(q->lock));
     int result = q->size;
@@ -75,5 +145,7 @@ void Queue_delete(Queue *q) {
     }
     
     pthread_mutex_destroy(&(q->lock));
+    pthread_cond_destroy(&(q->not_empty));
+    pthread_cond_destroy(&(q->not_full));
     free(q);
 }
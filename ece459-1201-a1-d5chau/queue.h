@@ -21,15 +21,26 @@ typedef struct Node {
 
 typedef struct Queue {
     unsigned size;
+    unsigned capacity;          /* Bound for Queue_put; 0 if unbounded */
+    int closed;                 /* No more elements will be put */
     Node *head;
     Node *tail;
     pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
 } Queue;
 
 extern Queue* Queue_init();
+extern Queue* Queue_init_bounded(unsigned capacity);
 extern void Queue_add(Queue *q, void *el);
 extern void* Queue_remove(Queue *q);
 extern int Queue_size(Queue *q);
 extern void Queue_delete(Queue *q);
 
+/* Blocking operations for producer/consumer pipelines */
+extern void Queue_put(Queue *q, void *el);
+extern void* Queue_take(Queue *q);
+extern int Queue_take_many(Queue *q, void **els, int max_els);
+extern void Queue_close(Queue *q);
+
 #endif
\ No newline at end of file
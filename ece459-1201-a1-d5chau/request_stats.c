@@ -0,0 +1,110 @@
+/*****************************************************************************
+ **
+ ** request_stats.c
+ **
+ ** Function implementations for the verifiers' request statistics
+ **
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include "request_stats.h"
+
+request_stats *request_stats_create(long now_us) {
+    request_stats *stats = malloc(sizeof(request_stats));
+    request_stats_reset(stats, now_us);
+    return stats;
+}
+
+void request_stats_reset(request_stats *stats, long now_us) {
+    histogram_reset(&stats->dns);
+    histogram_reset(&stats->connect);
+    histogram_reset(&stats->ttfb);
+    histogram_reset(&stats->total);
+    stats->num_requests = 0;
+    stats->num_puzzles = 0;
+    stats->num_curl_errors = 0;
+    stats->num_http_errors = 0;
+    stats->num_new_connections = 0;
+    stats->start_us = now_us;
+}
+
+/*
+ * Record one finished transfer; call before the easy handle is reused.
+ * ttfb_us (-1 if no response arrived) and total_us are measured by the caller.
+ * eh is NULL for requests sent without cURL, which have no phase timings
+ */
+void request_stats_record(request_stats *stats, CURL *eh, CURLcode result, long response_code,
+                          int num_puzzles, long ttfb_us, long total_us) {
+    curl_off_t dns_us = 0;
+    curl_off_t connect_us = 0;
+    long num_connects = 0;
+
+    stats->num_requests++;
+    stats->num_puzzles += num_puzzles;
+    if (result != CURLE_OK) {
+        stats->num_curl_errors++;
+        return;
+    }
+    if (response_code != 200) {
+        stats->num_http_errors++;
+    }
+
+    if (eh != NULL) {
+        curl_easy_getinfo(eh, CURLINFO_NAMELOOKUP_TIME_T, &dns_us);
+        curl_easy_getinfo(eh, CURLINFO_CONNECT_TIME_T, &connect_us);
+        curl_easy_getinfo(eh, CURLINFO_NUM_CONNECTS, &num_connects);
+    }
+
+    /* A reused connection reports zero for both; keep those out of the tails */
+    if (num_connects > 0) {
+        stats->num_new_connections += num_connects;
+        histogram_record(&stats->dns, (uint64_t) dns_us);
+        histogram_record(&stats->connect, (uint64_t) connect_us);
+    }
+    if (ttfb_us >= 0) {
+        histogram_record(&stats->ttfb, (uint64_t) ttfb_us);
+    }
+    histogram_record(&stats->total, (uint64_t) total_us);
+}
+
+void request_stats_merge(request_stats *dst, const request_stats *src) {
+    histogram_merge(&dst->dns, &src->dns);
+    histogram_merge(&dst->connect, &src->connect);
+    histogram_merge(&dst->ttfb, &src->ttfb);
+    histogram_merge(&dst->total, &src->total);
+    dst->num_requests += src->num_requests;
+    dst->num_puzzles += src->num_puzzles;
+    dst->num_curl_errors += src->num_curl_errors;
+    dst->num_http_errors += src->num_http_errors;
+    dst->num_new_connections += src->num_new_connections;
+    if (src->start_us < dst->start_us) {
+        dst->start_us = src->start_us;
+    }
+}
+
+static void print_phase(FILE *out, const char *name, const histogram *h) {
+    fprintf(out, "    %-8s %9.3f %9.3f %9.3f %9.3f %9.3f\n", name,
+            histogram_percentile(h, 50.0) / 1000.0,
+            histogram_percentile(h, 90.0) / 1000.0,
+            histogram_percentile(h, 99.0) / 1000.0,
+            histogram_percentile(h, 99.9) / 1000.0,
+            h->max / 1000.0);
+}
+
+void request_stats_print(const request_stats *stats, FILE *out, const char *label, long now_us) {
+    double seconds = (now_us - stats->start_us) / 1000000.0;
+    if (seconds <= 0) {
+        seconds = 1e-6;
+    }
+    fprintf(out, "[%s] %llu requests (%llu puzzles) in %.2f s: %.1f requests/s, %.1f puzzles/s\n",
+            label, (unsigned long long) stats->num_requests, (unsigned long long) stats->num_puzzles,
+            seconds, stats->num_requests / seconds, stats->num_puzzles / seconds);
+    fprintf(out, "    errors: %llu cURL, %llu HTTP; new connections: %llu\n",
+            (unsigned long long) stats->num_curl_errors, (unsigned long long) stats->num_http_errors,
+            (unsigned long long) stats->num_new_connections);
+    fprintf(out, "    %-8s %9s %9s %9s %9s %9s  (ms)\n", "", "p50", "p90", "p99", "p99.9", "max");
+    print_phase(out, "dns", &stats->dns);
+    print_phase(out, "connect", &stats->connect);
+    print_phase(out, "ttfb", &stats->ttfb);
+    print_phase(out, "total", &stats->total);
+}
@@ -0,0 +1,40 @@
+/*****************************************************************************
+ **
+ ** request_stats.h
+ **
+ ** Per-request timing and error accounting for the verifiers. Phase timings
+ ** are cumulative from the start of the transfer: DNS lookup, TCP connect,
+ ** time to first response byte, and total time. cURL 7.x stamps
+ ** STARTTRANSFER when a POST body starts going out, so the caller measures
+ ** the first byte, and the total on the same clock, itself.
+ **
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <curl/curl.h>
+#include "histogram.h"
+
+#ifndef REQUEST_STATS_H
+#define REQUEST_STATS_H
+
+typedef struct {
+    histogram dns;                  /* Only transfers that opened a connection */
+    histogram connect;              /* Only transfers that opened a connection */
+    histogram ttfb;
+    histogram total;
+    uint64_t num_requests;
+    uint64_t num_puzzles;
+    uint64_t num_curl_errors;
+    uint64_t num_http_errors;
+    uint64_t num_new_connections;
+    long start_us;
+} request_stats;
+
+extern request_stats *request_stats_create(long now_us);
+extern void request_stats_reset(request_stats *stats, long now_us);
+extern void request_stats_record(request_stats *stats, CURL *eh, CURLcode result, long response_code,
+                                 int num_puzzles, long ttfb_us, long total_us);
+extern void request_stats_merge(request_stats *dst, const request_stats *src);
+extern void request_stats_print(const request_stats *stats, FILE *out, const char *label, long now_us);
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ * A simple backtracking sudoku solver.  Accepts input with cells, dot (.)
+ * to represent blank spaces and rows separated by newlines. Output format is
+ * the same, only solved, so there will be no dots in it.
+ *
+ * Copyright (c) Mitchell Johnson (ehntoo@gmail.com), 2012
+ * Modifications 2019 by Jeff Zarnett (jzarnett@uwaterloo.ca) for the purposes
+ * of the ECE 459 assignment.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Solve-and-verify pipeline: a reader thread feeds puzzles through a
+ * bounded queue to solver threads, which hand solved grids through a
+ * second bounded queue to verifier threads. Verification is local
+ * (is_solved) or, with -u, batched HTTP requests on a kept-alive
+ * connection per verifier. Nothing goes through output.txt.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <time.h>
+#include <curl/curl.h>
+#include "common.h"
+#include "queue.h"
+
+/* Check the common header for the definition of puzzle */
+
+#define QUEUE_CAPACITY 1024 /* Puzzles buffered between stages; override with -q */
+
+/* Response body of a verification request */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} response_buffer;
+
+/* Check if current number is valid in this position;
+ * returns 1 if yes, 0 if not */
+int is_valid(int number, puzzle *p, int row, int column);
+
+int solve(puzzle *p, int row, int column);
+
+void *read_handler(void *args);
+
+void *solve_handler(void *args);
+
+void *verify_handler(void *args);
+
+/* Verify a batch through the server; returns the number verified or -1 */
+int verify_remote(CURL *eh, char *body, puzzle **batch, int num_puzzles, int batch_size, response_buffer *response);
+
+/* cURL write callback */
+size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata);
+
+int main(int argc, char **argv) {
+    /* Parse arguments */
+    int c;
+    int num_solvers = 1;
+    int num_verifiers = 1;
+    int batch_size = 1;
+    unsigned queue_capacity = QUEUE_CAPACITY;
+    char *filename = NULL;
+    char *url = NULL;
+    while ((c = getopt(argc, argv, "t:v:i:u:b:q:")) != -1) {
+        switch (c) {
+            case 't':
+                num_solvers = strtoul(optarg, NULL, 10);
+                if (num_solvers == 0) {
+                    printf("%s: option requires an argument > 0 -- 't'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'v':
+                num_verifiers = strtoul(optarg, NULL, 10);
+                if (num_verifiers == 0) {
+                    printf("%s: option requires an argument > 0 -- 'v'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i':
+                filename = optarg;
+                break;
+            case 'u':
+                url = optarg;
+                break;
+            case 'b':
+                batch_size = strtoul(optarg, NULL, 10);
+                if (batch_size == 0) {
+                    printf("%s: option requires an argument > 0 -- 'b'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                queue_capacity = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    /* Open file */
+    FILE *inputfile = fopen(filename, "r");
+    if (inputfile == NULL) {
+        printf("Unable to open input file.\n");
+        return EXIT_FAILURE;
+    }
+    if (url != NULL) {
+        curl_global_init(CURL_GLOBAL_ALL);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    sudoku_pipeline_input args;
+    memset(&args, 0, sizeof(args));
+    args.input_file = inputfile;
+    args.input_queue = Queue_init_bounded(queue_capacity);
+    args.output_queue = Queue_init_bounded(queue_capacity);
+    args.url = url;
+    args.batch_size = batch_size;
+
+    /* Start the stages back to front so every consumer is waiting */
+    pthread_t verifier_tids[num_verifiers];
+    sudoku_pipeline_input verifier_args[num_verifiers];
+    for (int i = 0; i < num_verifiers; i++) {
+        verifier_args[i] = args;
+        pthread_create(&verifier_tids[i], NULL, verify_handler, (void*) &verifier_args[i]);
+    }
+    pthread_t solver_tids[num_solvers];
+    for (int i = 0; i < num_solvers; i++) {
+        pthread_create(&solver_tids[i], NULL, solve_handler, (void*) &args);
+    }
+    pthread_t reader_tid;
+    pthread_create(&reader_tid, NULL, read_handler, (void*) &args);
+
+    /* Each stage closes the next one's queue once it has drained */
+    pthread_join(reader_tid, NULL);
+    for (int i = 0; i < num_solvers; i++) {
+        pthread_join(solver_tids[i], NULL);
+    }
+    Queue_close(args.output_queue);
+    int num_verified = 0;
+    int num_checked = 0;
+    for (int i = 0; i < num_verifiers; i++) {
+        pthread_join(verifier_tids[i], NULL);
+        num_verified += verifier_args[i].num_verified;
+        num_checked += verifier_args[i].num_checked;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%d puzzles read, %d solved and checked in %.3f s (%.1f puzzles/s)\n",
+            args.num_read, num_checked, seconds, args.num_read / seconds);
+    printf("%d of %d puzzles passed verification.\n", num_verified, args.num_read);
+
+    /* Cleanup */
+    Queue_delete(args.input_queue);
+    Queue_delete(args.output_queue);
+    if (url != NULL) {
+        curl_global_cleanup();
+    }
+    fclose( inputfile );
+    return 0;
+}
+
+/*
+ * Function being run by the reader thread; closes the input queue at EOF
+ */
+void *read_handler(void *args) {
+    sudoku_pipeline_input *arguments = (sudoku_pipeline_input*) args;
+    puzzle *p;
+
+    while ((p = read_next_puzzle(arguments->input_file)) != NULL) {
+        Queue_put(arguments->input_queue, (void*) p);
+        arguments->num_read++;
+    }
+    Queue_close(arguments->input_queue);
+    return NULL;
+}
+
+/*
+ * Function being run by solver threads until the input queue is closed
+ * and drained
+ */
+void *solve_handler(void *args) {
+    sudoku_pipeline_input *arguments = (sudoku_pipeline_input*) args;
+    puzzle *p;
+
+    while ((p = (puzzle*) Queue_take(arguments->input_queue)) != NULL) {
+        if (solve(p, 0, 0)) {
+            Queue_put(arguments->output_queue, (void*) p);
+        } else {
+            printf("Illegal sudoku (or a broken algorithm)\n");
+            free(p);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function being run by verifier threads until the output queue is closed
+ * and drained. Each takes whatever is queued, up to a batch, so requests
+ * never wait for a batch to fill
+ */
+void *verify_handler(void *args) {
+    sudoku_pipeline_input *arguments = (sudoku_pipeline_input*) args;
+    int batch_size = arguments->batch_size;
+    puzzle **batch = malloc(batch_size * sizeof(puzzle*));
+    CURL *eh = NULL;
+    char *body = NULL;
+    response_buffer response = { NULL, 0, 0 };
+    struct curl_slist *headers = NULL;
+
+    if (arguments->url != NULL) {
+        /* One template and one kept-alive connection per verifier */
+        if (batch_size == 1) {
+            body = malloc(PUZZLE_JSON_LENGTH + 1);
+            init_puzzle_json(body);
+        } else {
+            body = malloc(BATCH_JSON_LENGTH(batch_size) + 1);
+            init_batch_json(body, batch_size);
+        }
+        /* Room for "[1,0,...]" plus slack for a short error message */
+        response.capacity = 2 * batch_size + 64;
+        response.data = malloc(response.capacity + 1);
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+        headers = curl_slist_append(headers, "Expect:");
+        eh = curl_easy_init();
+        curl_easy_setopt(eh, CURLOPT_URL, arguments->url);
+        curl_easy_setopt(eh, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(eh, CURLOPT_WRITEDATA, &response);
+        curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(eh, CURLOPT_TCP_NODELAY, 1L);
+    }
+
+    int num_puzzles;
+    while ((num_puzzles = Queue_take_many(arguments->output_queue, (void**) batch, batch_size)) > 0) {
+        int verified = 0;
+        if (eh == NULL) {
+            for (int i = 0; i < num_puzzles; i++) {
+                verified += is_solved(batch[i]);
+            }
+        } else if ((verified = verify_remote(eh, body, batch, num_puzzles, batch_size, &response)) < 0) {
+            verified = 0;
+        }
+        arguments->num_verified += verified;
+        arguments->num_checked += num_puzzles;
+        for (int i = 0; i < num_puzzles; i++) {
+            free(batch[i]);
+        }
+    }
+
+    if (eh != NULL) {
+        curl_easy_cleanup(eh);
+        curl_slist_free_all(headers);
+    }
+    free(response.data);
+    free(body);
+    free(batch);
+    return NULL;
+}
+
+int verify_remote(CURL *eh, char *body, puzzle **batch, int num_puzzles, int batch_size, response_buffer *response) {
+    size_t length;
+    if (batch_size == 1) {
+        /* Plain requests stay compatible with the course server */
+        encode_grid_json(batch[0], PUZZLE_JSON_GRID(body));
+        length = PUZZLE_JSON_LENGTH;
+    } else {
+        for (int i = 0; i < num_puzzles; i++) {
+            encode_grid_json(batch[i], BATCH_JSON_GRID(body, i));
+        }
+        length = close_batch_json(body, num_puzzles);
+    }
+    response->length = 0;
+    response->data[0] = '\0';
+    curl_easy_setopt(eh, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(eh, CURLOPT_POSTFIELDSIZE, (long) length);
+
+    CURLcode res = curl_easy_perform(eh);
+    if (res != CURLE_OK) {
+        fprintf(stderr, "Error occurred in executing the cURL request: %s\n", curl_easy_strerror(res));
+        return -1;
+    }
+    long response_code;
+    curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &response_code);
+    if (response_code != 200) {
+        fprintf(stderr, "Error in HTTP request; HTTP code %lu received.\n", response_code);
+        return -1;
+    }
+    if (batch_size == 1) {
+        return atoi(response->data);
+    }
+    int verified = parse_batch_response(response->data, num_puzzles, NULL);
+    if (verified < 0) {
+        fprintf(stderr, "Malformed batch response: %s\n", response->data);
+    }
+    return verified;
+}
+
+size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    response_buffer *response = (response_buffer*) userdata;
+    size_t length = size * nmemb;
+    size_t room = response->capacity - response->length;
+    size_t to_copy = length < room ? length : room;
+    memcpy(response->data + response->length, ptr, to_copy);
+    response->length += to_copy;
+    response->data[response->length] = '\0';
+    return length;
+}
+
+/*
+ * A recursive function that does all the gruntwork in solving
+ * the puzzle.
+ */
+int solve(puzzle *p, int row, int column) {
+    int nextNumber = 1;
+    /*
+     * Have we advanced past the puzzle?  If so, hooray, all
+     * previous cells have valid contents!  We're done!
+     */
+    if (9 == row) {
+        return 1;
+    }
+
+    /*
+     * Is this element already set?  If so, we don't want to
+     * change it.
+     */
+    if (p->content[row][column]) {
+        if (column == 8) {
+            if (solve(p, row + 1, 0)) return 1;
+        } else {
+            if (solve(p, row, column + 1)) return 1;
+        }
+        return 0;
+    }
+
+    /*
+     * Iterate through the possible numbers for this empty cell
+     * and recurse for every valid one, to test if it's part
+     * of the valid solution.
+     */
+    for (; nextNumber < 10; nextNumber++) {
+        if (is_valid(nextNumber, p, row, column)) {
+            p->content[row][column] = nextNumber;
+            if (column == 8) {
+                if (solve(p, row + 1, 0)) return 1;
+            } else {
+                if (solve(p, row, column + 1)) return 1;
+            }
+            p->content[row][column] = 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Checks to see if a particular value is presently valid in a
+ * given position.
+ */
+int is_valid(int number, puzzle *p, int row, int column) {
+    int modRow = 3 * (row / 3);
+    int modCol = 3 * (column / 3);
+    int row1 = (row + 2) % 3;
+    int row2 = (row + 4) % 3;
+    int col1 = (column + 2) % 3;
+    int col2 = (column + 4) % 3;
+
+    /* Check for the value in the given row and column */
+    for (int i = 0; i < 9; i++) {
+        if (p->content[i][column] == number) return 0;
+        if (p->content[row][i] == number) return 0;
+    }
+
+    /* Check the remaining four spaces in this sector */
+    if (p->content[row1 + modRow][col1 + modCol] == number) return 0;
+    if (p->content[row2 + modRow][col1 + modCol] == number) return 0;
+    if (p->content[row1 + modRow][col2 + modCol] == number) return 0;
+    if (p->content[row2 + modRow][col2 + modCol] == number) return 0;
+    return 1;
+}
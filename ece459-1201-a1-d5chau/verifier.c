@@ -1,58 +1,122 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <curl/curl.h>
 #include <getopt.h>
 #include "common.h"
+#include "request_stats.h"
+#include "cache.h"
 
 /* Check the common header for the definition of puzzle */
 
-#define URL "http://berkeley.uwaterloo.ca:4590/verify"
-#define ROW_LENGTH 20
-#define MATRIX_LENGTH 202
+#define URL "http://berkeley.uwaterloo.ca:4590/verify" /* Default endpoint; override with -u */
+#define REPORT_INTERVAL 10 /* Seconds between interim statistics; override with -r, 0 disables */
+#define RECEIVE_BUFFER_SIZE 65536
+#define REPLY_CAPACITY 64 /* A verdict plus slack for a short error message */
+
+/* Request body being uploaded and how much of it cURL has already read */
+typedef struct {
+    char *body;
+    size_t length;
+    size_t offset;
+} upload;
+
+/* The server's reply as the write callback collects it */
+typedef struct {
+    long first_byte_us;     /* -1 until the first response data arrives */
+    size_t length;
+    char body[REPLY_CAPACITY + 1];  /* Truncated to REPLY_CAPACITY, always terminated */
+} reply;
 
-const char *ROW_FORMAT = "[%d,%d,%d,%d,%d,%d,%d,%d,%d]";
-const char *MATRIX_FORMAT = "{\"content\":[%s, %s, %s, %s, %s, %s, %s, %s, %s]}";
+/* Statistics since the start and since the previous interim report */
+typedef struct {
+    request_stats *totals;
+    request_stats *interval;
+    long interval_us;       /* 0 if interim reports are disabled */
+    long next_us;
+} stats_report;
+
+/* Requests written ahead on the pipelined connection, oldest first */
+typedef struct {
+    uint64_t *keys;
+    long *sent_us;
+    int head;
+    int count;
+    int depth;
+} pipeline_window;
 
 /* Create cURL easy handle and configure it */
-CURL *create_eh(const int *result_code, const char *json_to_send, const struct curl_slist *headers);
+CURL *create_eh(reply *received, upload *to_send, const struct curl_slist *headers, const char *url);
+
+/* Open a TCP connection to the host of an http:// URL; -1 on failure */
+int connect_url(const char *url, char *host, size_t host_size, char *path, size_t path_size);
+
+/* Length of the complete response at the start of a buffer; 0 if partial, -1 if unusable */
+long parse_response(const char *buffer, size_t length, int *status, int *verdict);
+
+/* Verify the whole file over one pipelined connection; returns the number verified */
+int verify_pipelined(FILE *inputfile, const char *url, int depth, verify_cache *cache,
+                     stats_report *report, int *total_puzzles);
+
+/* Print and fold the interim statistics into the totals if the report
+ * interval has elapsed */
+void maybe_report(stats_report *report);
 
 /* Configure headers for the cURL request */
 struct curl_slist *config_headers();
 
-/* Transform the puzzle into an appropriate json format for the server */
-char *convert_to_json(puzzle *p);
-
 /* cURL read callback */
 size_t read_callback(char *buffer, size_t size, size_t nitems, void *userdata);
 
 /* cURL write callback */
 size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata);
 
-int verify(puzzle *p) {
-    int *result = malloc(sizeof(int));
-    char *converted = convert_to_json(p);
-    struct curl_slist *headers = config_headers();
-    CURL *eh = create_eh(result, converted, headers);
+/* Current value of the monotonic clock in microseconds */
+long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/*
+ * Ask the server about one puzzle on the run's easy handle, which keeps its
+ * connection open between calls; returns the verdict, or -1 if the server
+ * answered with an error
+ */
+int verify(CURL *eh, puzzle *p, upload *to_send, reply *received, request_stats *stats) {
+    encode_grid_json(p, PUZZLE_JSON_GRID(to_send->body));
+    to_send->offset = 0;
+    received->first_byte_us = -1;
+    received->length = 0;
+    received->body[0] = '\0';
+
+    long start_us = now_us();
 
     CURLcode res = curl_easy_perform(eh);
+    long response_code = 0;
+    curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &response_code);
+    request_stats_record(stats, eh, res, response_code, 1,
+                         received->first_byte_us < 0 ? -1 : received->first_byte_us - start_us,
+                         now_us() - start_us);
     if (res != CURLE_OK) {
         printf("Error occurred in executing the cURL request: %s\n",
                curl_easy_strerror(res));
         exit(EXIT_FAILURE);
     }
-    long response_code;
-    curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &response_code);
     if (response_code != 200) {
         printf("Error in HTTP request; HTTP code %lu received.\n", response_code);
+        return -1;
     }
-
-    curl_easy_cleanup(eh);
-    curl_slist_free_all(headers);
-    int ret = *result;
-    free(result);
-    free(converted);
-    return ret;
+    return atoi(received->body) != 0;
 }
 
 int main(int argc, char **argv) {
@@ -60,7 +124,11 @@ int main(int argc, char **argv) {
     int c;
     int num_connections = 1;
     char* filename = NULL;
-    while ((c = getopt(argc, argv, "t:i:")) != -1) {
+    char* url = URL;
+    char* cache_file = NULL;
+    long report_interval = REPORT_INTERVAL;
+    int pipeline_depth = 0;
+    while ((c = getopt(argc, argv, "t:i:u:r:C:P:")) != -1) {
         switch (c) {
             case 't':
                 num_connections = strtoul(optarg, NULL, 10);
@@ -72,6 +140,20 @@ int main(int argc, char **argv) {
             case 'i':
                 filename = optarg;
                 break;
+            case 'u':
+                url = optarg;
+                break;
+            case 'r':
+                report_interval = strtol(optarg, NULL, 10);
+                break;
+            case 'C':
+                /* Persist the cache across runs */
+                cache_file = optarg;
+                break;
+            case 'P':
+                /* Bypass cURL and pipeline this many requests; local server only */
+                pipeline_depth = strtoul(optarg, NULL, 10);
+                break;
             default:
                 return -1;
         }
@@ -86,15 +168,58 @@ int main(int argc, char **argv) {
 
     curl_global_init(CURL_GLOBAL_ALL);
 
+    /* The body template is written once; each puzzle only fills in digits */
+    char body[PUZZLE_JSON_LENGTH + 1];
+    init_puzzle_json(body);
+    upload to_send = { body, PUZZLE_JSON_LENGTH, 0 };
+
+    /* Interim reports cover only the requests since the previous one */
+    long start_us = now_us();
+    stats_report report;
+    report.totals = request_stats_create(start_us);
+    report.interval = request_stats_create(start_us);
+    report.interval_us = report_interval > 0 ? report_interval * 1000000L : 0;
+    report.next_us = start_us + report.interval_us;
+
+    /* Grids seen before, in this run or a saved one, never go to the server */
+    verify_cache *cache = cache_create();
+    if (cache_file != NULL && cache_load(cache, cache_file) < 0) {
+        fprintf(stderr, "No cache at %s yet; it will be created.\n", cache_file);
+    }
+
+    /* One easy handle and header list for the whole run */
+    struct curl_slist *headers = config_headers();
+    reply received = { -1, 0, "" };
+    CURL *eh = create_eh(&received, &to_send, headers, url);
+
     /* Check puzzles */
     int verified = 0;
     int total_puzzles = 0;
-    puzzle *p;
-    while ((p = read_next_puzzle(inputfile)) != NULL) {
+    puzzle p;
+    if (pipeline_depth > 0) {
+        verified = verify_pipelined(inputfile, url, pipeline_depth, cache, &report, &total_puzzles);
+    }
+    while (pipeline_depth == 0 && read_puzzle(inputfile, &p)) {
         total_puzzles++;
-        verified += verify(p);
-        free(p);
+        uint64_t key = grid_hash(&p);
+        int verdict = cache_lookup(cache, key);
+        if (verdict < 0 && (verdict = verify(eh, &p, &to_send, &received, report.interval)) >= 0) {
+            cache_insert(cache, key, verdict);
+        }
+        verified += verdict > 0;
+        maybe_report(&report);
+    }
+    request_stats_merge(report.totals, report.interval);
+    request_stats_print(report.totals, stderr, "total", now_us());
+    cache_print(cache, stderr);
+    if (cache_file != NULL && cache_save(cache, cache_file) < 0) {
+        fprintf(stderr, "Unable to save the cache to %s.\n", cache_file);
     }
+    cache_delete(cache);
+    free(report.totals);
+    free(report.interval);
+    curl_easy_cleanup(eh);
+    curl_slist_free_all(headers);
 
     printf("%d of %d puzzles passed verification.\n", verified, total_puzzles);
     curl_global_cleanup();
@@ -102,45 +227,33 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-char *convert_to_json(puzzle *p) {
-    char *rows[9];
-    for (int i = 0; i < 9; i++) {
-        rows[i] = malloc(ROW_LENGTH);
-        memset(rows[i], 0, ROW_LENGTH);
-        int written = sprintf(rows[i], ROW_FORMAT,
-                              p->content[i][0], p->content[i][1], p->content[i][2],
-                              p->content[i][3], p->content[i][4], p->content[i][5],
-                              p->content[i][6], p->content[i][7], p->content[i][8]);
-        if (written != ROW_LENGTH - 1) {
-            printf("Something went wrong when writing row; expected to write %d but wrote %d...\n",
-                    ROW_LENGTH -1, written);
-        }
-    }
-    char *json = malloc(MATRIX_LENGTH);
-    memset(json, 0, MATRIX_LENGTH);
-    int written = sprintf(json, MATRIX_FORMAT,
-                          rows[0], rows[1], rows[2], rows[3], rows[4],
-                          rows[5], rows[6], rows[7], rows[8]);
-    if (written != MATRIX_LENGTH - 1) {
-        printf("Something went wrong when writing matrix; expected to write %d but wrote %d...\n",
-               MATRIX_LENGTH -1, written);
-    }
-    for (int i = 0; i < 9; i++) {
-        free(rows[i]);
-    }
-    return json;
-}
-
+/*
+ * Stream the body to cURL, as much as it has room for on each call
+ */
 size_t read_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
-    memcpy(buffer, userdata, MATRIX_LENGTH);
-    return MATRIX_LENGTH;
+    upload *to_send = (upload*) userdata;
+    size_t remaining = to_send->length - to_send->offset;
+    size_t to_copy = size * nitems < remaining ? size * nitems : remaining;
+    memcpy(buffer, to_send->body + to_send->offset, to_copy);
+    to_send->offset += to_copy;
+    return to_copy;
 }
 
 size_t write_callback(char *ptr, size_t size, size_t nmemb, void  *userdata) {
-    printf("Write callback message from server: %s\n", ptr);
-    int * p = (int*) userdata;
-    *p = atoi(ptr);
-    return size * nmemb;
+    reply *received = (reply*) userdata;
+    if (received->first_byte_us < 0) {
+        received->first_byte_us = now_us();
+    }
+
+    /* The body may arrive in pieces and is not terminated; verify parses it
+     * once the transfer is complete */
+    size_t length = size * nmemb;
+    size_t room = REPLY_CAPACITY - received->length;
+    size_t to_copy = length < room ? length : room;
+    memcpy(received->body + received->length, ptr, to_copy);
+    received->length += to_copy;
+    received->body[received->length] = '\0';
+    return length;
 }
 
 struct curl_slist *config_headers() {
@@ -150,17 +263,228 @@ struct curl_slist *config_headers() {
     return headers;
 }
 
-CURL *create_eh(const int *result, const char *json_to_send, const struct curl_slist *headers) {
+CURL *create_eh(reply *received, upload *to_send, const struct curl_slist *headers, const char *url) {
     CURL *eh = curl_easy_init();
     curl_easy_setopt(eh, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(eh, CURLOPT_URL, URL);
+    curl_easy_setopt(eh, CURLOPT_URL, url);
     curl_easy_setopt(eh, CURLOPT_POST, 1L);
     curl_easy_setopt(eh, CURLOPT_READFUNCTION, read_callback);
-    curl_easy_setopt(eh, CURLOPT_READDATA, json_to_send);
+    curl_easy_setopt(eh, CURLOPT_READDATA, to_send);
     curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(eh, CURLOPT_WRITEDATA, result);
-    curl_easy_setopt(eh, CURLOPT_POSTFIELDSIZE, MATRIX_LENGTH);
+    curl_easy_setopt(eh, CURLOPT_WRITEDATA, received);
+    curl_easy_setopt(eh, CURLOPT_POSTFIELDSIZE, (long) to_send->length);
+    /* Keep the one connection open and send each small request at once */
+    curl_easy_setopt(eh, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(eh, CURLOPT_TCP_KEEPALIVE, 1L);
     return eh;
 }
 
+int connect_url(const char *url, char *host, size_t host_size, char *path, size_t path_size) {
+    if (strncmp(url, "http://", 7) != 0) {
+        fprintf(stderr, "Pipelining needs a plain http:// URL, not %s\n", url);
+        return -1;
+    }
+    const char *authority = url + 7;
+    const char *slash = strchr(authority, '/');
+    size_t authority_length = slash != NULL ? (size_t) (slash - authority) : strlen(authority);
+    if (authority_length + 1 > host_size) {
+        return -1;
+    }
+    memcpy(host, authority, authority_length);
+    host[authority_length] = '\0';
+    snprintf(path, path_size, "%s", slash != NULL ? slash : "/");
 
+    /* host keeps the port for the Host header; the lookup needs them apart */
+    char name[256];
+    snprintf(name, sizeof(name), "%s", host);
+    char *colon = strrchr(name, ':');
+    const char *port = "80";
+    if (colon != NULL) {
+        *colon = '\0';
+        port = colon + 1;
+    }
+
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(name, port, &hints, &addresses) != 0) {
+        fprintf(stderr, "Unable to resolve %s\n", name);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = addresses; a != NULL && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to connect to %s\n", host);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/*
+ * Parse one complete response at the start of the buffer. Returns its
+ * length, 0 if more data is needed, or -1 if it is not HTTP/1.1 with a
+ * Content-Length
+ */
+long parse_response(const char *buffer, size_t length, int *status, int *verdict) {
+    const char *end_of_headers = NULL;
+    for (size_t i = 0; i + 4 <= length; i++) {
+        if (memcmp(buffer + i, "\r\n\r\n", 4) == 0) {
+            end_of_headers = buffer + i + 4;
+            break;
+        }
+    }
+    if (end_of_headers == NULL) {
+        return 0;
+    }
+    if (sscanf(buffer, "HTTP/1.1 %d", status) != 1) {
+        return -1;
+    }
+
+    long content_length = -1;
+    for (const char *line = strstr(buffer, "\r\n") + 2; line < end_of_headers - 2; line = strstr(line, "\r\n") + 2) {
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            content_length = strtol(line + 15, NULL, 10);
+        }
+    }
+    if (content_length < 0) {
+        return -1;
+    }
+    long header_length = end_of_headers - buffer;
+    if ((size_t) (header_length + content_length) > length) {
+        return 0;
+    }
+    *verdict = content_length > 0 && end_of_headers[0] == '1';
+    return header_length + content_length;
+}
+
+int verify_pipelined(FILE *inputfile, const char *url, int depth, verify_cache *cache,
+                     stats_report *report, int *total_puzzles) {
+    char host[256];
+    char path[1024];
+    int fd = connect_url(url, host, sizeof(host), path, sizeof(path));
+    if (fd < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* Every request is the same header followed by a filled-in template */
+    char header[1536];
+    int header_length = snprintf(header, sizeof(header),
+            "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n",
+            path, host, PUZZLE_JSON_LENGTH);
+    size_t request_length = header_length + PUZZLE_JSON_LENGTH;
+    char *requests = malloc(request_length * depth + 1);     /* The template ends in a NUL */
+    for (int i = 0; i < depth; i++) {
+        memcpy(requests + i * request_length, header, header_length);
+        init_puzzle_json(requests + i * request_length + header_length);
+    }
+
+    pipeline_window window = { malloc(depth * sizeof(uint64_t)), malloc(depth * sizeof(long)), 0, 0, depth };
+    char *received = malloc(RECEIVE_BUFFER_SIZE);
+    size_t received_length = 0;
+    int input_done = 0;
+    int verified = 0;
+    puzzle p;
+
+    while (!input_done || window.count > 0) {
+        /* Top the window up; the new requests go out in one write */
+        int num_new = 0;
+        while (!input_done && window.count + num_new < depth) {
+            if (!read_puzzle(inputfile, &p)) {
+                input_done = 1;
+                break;
+            }
+            (*total_puzzles)++;
+            uint64_t key = grid_hash(&p);
+            int verdict = cache_lookup(cache, key);
+            if (verdict >= 0) {
+                verified += verdict;
+                continue;
+            }
+            int slot = (window.head + window.count + num_new) % depth;
+            window.keys[slot] = key;
+            encode_grid_json(&p, PUZZLE_JSON_GRID(requests + num_new * request_length + header_length));
+            num_new++;
+        }
+        long now = now_us();
+        for (size_t sent = 0; sent < num_new * request_length;) {
+            ssize_t n = write(fd, requests + sent, num_new * request_length - sent);
+            if (n <= 0) {
+                perror("write");
+                exit(EXIT_FAILURE);
+            }
+            sent += n;
+        }
+        for (int i = 0; i < num_new; i++) {
+            window.sent_us[(window.head + window.count + i) % depth] = now;
+        }
+        window.count += num_new;
+        if (window.count == 0) {
+            break;
+        }
+
+        /* Wait for at least the oldest response, then take every one that is complete */
+        ssize_t n = read(fd, received + received_length, RECEIVE_BUFFER_SIZE - 1 - received_length);
+        if (n <= 0) {
+            fprintf(stderr, "Server closed the connection with %d requests outstanding\n", window.count);
+            exit(EXIT_FAILURE);
+        }
+        received_length += n;
+        received[received_length] = '\0';
+        long response_length;
+        int status;
+        int verdict;
+        size_t consumed = 0;
+        while (window.count > 0
+                && (response_length = parse_response(received + consumed, received_length - consumed, &status, &verdict)) > 0) {
+            long elapsed_us = now_us() - window.sent_us[window.head];
+            request_stats_record(report->interval, NULL, CURLE_OK, status, 1, elapsed_us, elapsed_us);
+            if (status == 200) {
+                cache_insert(cache, window.keys[window.head], verdict);
+                verified += verdict;
+            } else {
+                printf("Error in HTTP request; HTTP code %d received.\n", status);
+            }
+            window.head = (window.head + 1) % depth;
+            window.count--;
+            consumed += response_length;
+        }
+        if (response_length < 0) {
+            fprintf(stderr, "Unexpected response from server: %.64s\n", received + consumed);
+            exit(EXIT_FAILURE);
+        }
+        memmove(received, received + consumed, received_length - consumed);
+        received_length -= consumed;
+        maybe_report(report);
+    }
+
+    close(fd);
+    free(requests);
+    free(window.keys);
+    free(window.sent_us);
+    free(received);
+    return verified;
+}
+
+void maybe_report(stats_report *report) {
+    if (report->interval_us == 0) {
+        return;
+    }
+    long now = now_us();
+    if (now < report->next_us) {
+        return;
+    }
+    request_stats_print(report->interval, stderr, "interval", now);
+    request_stats_merge(report->totals, report->interval);
+    request_stats_reset(report->interval, now);
+    report->next_us = now + report->interval_us;
+}
@@ -1,29 +1,131 @@
+#define _XOPEN_SOURCE 700
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <pthread.h>
 #include <curl/curl.h>
 #include <curl/multi.h>
 #include <getopt.h>
 #include "common.h"
+#include "aimd.h"
+#include "request_stats.h"
+#include "cache.h"
 
 /* Check the common header for the definition of puzzle */
 
-#define URL "http://berkeley.uwaterloo.ca:4590/verify"
-#define ROW_LENGTH 20
-#define MATRIX_LENGTH 202
-#define MAX_WAIT_MSECS 30*1000 /* Wait max. 30 seconds */
+#define URL "http://berkeley.uwaterloo.ca:4590/verify" /* Default endpoint; override with -u */
+#define MAX_EVENTS 256
+#define REPORT_INTERVAL 10 /* Seconds between interim statistics; override with -r, 0 disables */
+#define TIMEOUT_MS 30000   /* Per-transfer timeout; override with -T, 0 disables */
+#define MAX_RETRIES 3      /* Attempts after the first; override with -R */
+#define RETRY_BASE_MS 50   /* Backoff before the first retry, doubled for each one after */
+#define RETRY_MAX_MS 2000
+#define HEDGE_PERCENTILE 95.0
+#define HEDGE_MIN_SAMPLES 20 /* Successful attempts observed before hedging starts */
+
+struct request_slot;
+
+/* A batch of puzzles to verify and the transfers currently carrying it */
+typedef struct {
+    char *body;             /* JSON template, encoded in place for each batch */
+    size_t body_length;
+    int num_puzzles;        /* Number of grids carried by the batch */
+    uint64_t *keys;         /* Cache key of each grid */
+    unsigned char *verdicts; /* Per-grid results of a batched response */
+    int attempt;            /* 0 for the first try, incremented for each retry */
+    long seq;               /* Controller sequence number of the current attempt */
+    long attempt_start_us;
+    long generation;        /* Bumped to invalidate the job's pending timer */
+    struct request_slot *transfers[2]; /* Primary and hedge in flight */
+    int num_transfers;
+} request_job;
+
+/* An easy handle and the state of the transfer it is carrying */
+typedef struct request_slot {
+    CURL *eh;
+    request_job *job;
+    size_t body_offset;     /* How much of the job's body cURL has already read */
+    char *response;         /* Response body received so far */
+    size_t response_length;
+    size_t response_capacity;
+    long start_us;          /* When the transfer was handed to the multi handle */
+    long first_byte_us;     /* When the first response data arrived, -1 until then */
+    int hedge;              /* Started while another transfer carried the job */
+} request_slot;
+
+/* A retry or hedge due for a job; stale once the job's generation moves on */
+typedef struct {
+    long due_us;
+    request_job *job;
+    long generation;
+} job_timer;
 
-const char *ROW_FORMAT = "[%d,%d,%d,%d,%d,%d,%d,%d,%d]";
-const char *MATRIX_FORMAT = "{\"content\":[%s, %s, %s, %s, %s, %s, %s, %s, %s]}";
+/*
+ * State of one shard: a thread with its own event loop, multi handle and
+ * connection pool. Shards share only the input file
+ */
+typedef struct {
+    /* Configuration, filled in by main */
+    int id;
+    const char *url;
+    const struct curl_slist *headers;
+    int num_connections;
+    int adaptive;
+    long timeout_ms;
+
+    CURLM *cm;
+    int epfd;
+    long timer_deadline; /* Monotonic ms at which cURL wants a timeout action, -1 if none */
+    FILE *inputfile;
+    int input_done;
+    int batch_size;
+    puzzle *read_buffer;        /* One batch, read under the input lock */
+    verify_cache *cache;        /* Shared by all shards */
+    request_job **idle_jobs;    /* Jobs not holding a batch */
+    int num_idle_jobs;
+    request_slot **idle_slots;  /* Easy handles not currently in flight */
+    int num_idle_slots;
+    job_timer *timers;          /* Binary min-heap ordered by due_us */
+    int num_timers;
+    int timers_capacity;
+    aimd_controller controller; /* Decides how many jobs may be in flight */
+    int num_in_flight;          /* Jobs holding a batch, including those backing off */
+    int num_verified;
+    int num_total_puzzles;
+    int num_unverified;         /* Puzzles given up on after the last retry */
+    int max_retries;
+    int hedging;
+    unsigned short rand_state[3]; /* erand48 state for backoff jitter */
+    histogram *latencies;       /* Successful attempts; the hedge delay comes from here */
+    long num_retries;
+    long num_hedges;
+    long num_hedge_wins;
+    request_stats *totals;
+    request_stats *interval;    /* Requests finished since the last interim report */
+    long report_interval_us;    /* 0 if interim reports are disabled */
+    long next_report_us;
+} verifier_context;
+
+/* Thread entry point; runs one shard to completion */
+void *verify_shard(void *arg);
 
 /* Create cURL easy handle and configure it */
-CURL *create_eh(const int *result, const struct curl_slist *headers);
+CURL *create_eh(request_slot *slot, const struct curl_slist *headers, const char *url, long timeout_ms);
 
 /* Configure headers for the cURL request */
 struct curl_slist *config_headers();
 
-/* Transform the puzzle into an appropriate json format for the server */
-char *convert_to_json(puzzle *p);
+/* Queue a retry or hedge for a job */
+void push_timer(verifier_context *ctx, request_job *job, long due_us);
+
+/* Start the retries and hedges that have come due */
+void fire_timers(verifier_context *ctx);
 
 /* cURL read callback */
 size_t read_callback(char *buffer, size_t size, size_t nitems, void *userdata);
@@ -31,43 +133,338 @@ size_t read_callback(char *buffer, size_t size, size_t nitems, void *userdata);
 /* cURL write callback */
 size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata);
 
-void verify(CURLM *cm) {
-    int still_running = 0;
-    curl_multi_perform(cm, &still_running);
+/* cURL multi socket callback; mirrors cURL's interest in a socket into epoll */
+int socket_callback(CURL *eh, curl_socket_t s, int what, void *userp, void *socketp);
+
+/* cURL multi timer callback; records when cURL next wants a timeout action */
+int timer_callback(CURLM *cm, long timeout_ms, void *userp);
+
+/* Current value of the monotonic clock in milliseconds */
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Current value of the monotonic clock in microseconds */
+long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/*
+ * Load the next puzzles the cache cannot answer from file into the job's
+ * body; returns the number of puzzles loaded, 0 on EOF
+ */
+int load_job(verifier_context *ctx, request_job *job) {
+    int num_puzzles = 0;
+    while (num_puzzles == 0 && !ctx->input_done) {
+        /* Only the read is serialized; encoding runs in parallel across shards */
+        int num_read = read_puzzles_with_lock(ctx->inputfile, ctx->read_buffer, ctx->batch_size);
+        if (num_read == 0) {
+            ctx->input_done = 1;
+            break;
+        }
+        ctx->num_total_puzzles += num_read;
 
-    do {
-        int numfds = 0;
-        int res = curl_multi_wait(cm, NULL, 0, MAX_WAIT_MSECS, &numfds);
-        if (res != CURLM_OK) {
-            fprintf(stderr, "error: curl_multi_wait() returned %d\n", res);
+        for (int i = 0; i < num_read; i++) {
+            /* Grids seen before are settled here and never sent */
+            uint64_t key = grid_hash(&ctx->read_buffer[i]);
+            int verdict = cache_lookup(ctx->cache, key);
+            if (verdict >= 0) {
+                ctx->num_verified += verdict;
+                continue;
+            }
+
+            /* Digits go straight into the job's preallocated template */
+            job->keys[num_puzzles] = key;
+            if (ctx->batch_size == 1) {
+                encode_grid_json(&ctx->read_buffer[i], PUZZLE_JSON_GRID(job->body));
+            } else {
+                encode_grid_json(&ctx->read_buffer[i], BATCH_JSON_GRID(job->body, num_puzzles));
+            }
+            num_puzzles++;
+        }
+    }
+
+    if (ctx->batch_size == 1) {
+        /* Plain requests stay compatible with the course server */
+        job->body_length = PUZZLE_JSON_LENGTH;
+    } else {
+        job->body_length = close_batch_json(job->body, num_puzzles);
+    }
+    job->num_puzzles = num_puzzles;
+    return num_puzzles;
+}
+
+/* Hand the job's body to an idle easy handle; returns 0 if none is free */
+int start_transfer(verifier_context *ctx, request_job *job) {
+    if (ctx->num_idle_slots == 0) {
+        return 0;
+    }
+    request_slot *slot = ctx->idle_slots[--ctx->num_idle_slots];
+    slot->job = job;
+    slot->body_offset = 0;
+    slot->response_length = 0;
+    slot->response[0] = '\0';
+    slot->start_us = now_us();
+    slot->first_byte_us = -1;
+    slot->hedge = job->num_transfers > 0;
+    curl_easy_setopt(slot->eh, CURLOPT_POSTFIELDSIZE, (long) job->body_length);
+    curl_multi_add_handle(ctx->cm, slot->eh);
+    job->transfers[job->num_transfers++] = slot;
+    return 1;
+}
+
+/* Take a transfer off the multi handle, aborting it if it is still running */
+void drop_transfer(verifier_context *ctx, request_slot *slot) {
+    request_job *job = slot->job;
+    curl_multi_remove_handle(ctx->cm, slot->eh);
+    for (int i = 0; i < job->num_transfers; i++) {
+        if (job->transfers[i] == slot) {
+            job->transfers[i] = job->transfers[--job->num_transfers];
+            break;
+        }
+    }
+    slot->job = NULL;
+    ctx->idle_slots[ctx->num_idle_slots++] = slot;
+}
+
+/* Send the job, and arm its hedge once the p95 latency is known */
+void start_attempt(verifier_context *ctx, request_job *job) {
+    job->seq = aimd_on_start(&ctx->controller);
+    job->attempt_start_us = now_us();
+    start_transfer(ctx, job);
+    if (ctx->hedging && ctx->latencies->total >= HEDGE_MIN_SAMPLES) {
+        push_timer(ctx, job, job->attempt_start_us + (long) histogram_percentile(ctx->latencies, HEDGE_PERCENTILE));
+    }
+}
+
+/* Return a job to the idle pool, cancelling any timer it has pending */
+void release_job(verifier_context *ctx, request_job *job) {
+    job->generation++;
+    ctx->idle_jobs[ctx->num_idle_jobs++] = job;
+    ctx->num_in_flight--;
+}
+
+/* Exponential backoff before the given retry; the upper half is jittered */
+long retry_backoff_us(verifier_context *ctx, int attempt) {
+    long backoff_ms = RETRY_BASE_MS;
+    for (int i = 1; i < attempt && backoff_ms < RETRY_MAX_MS; i++) {
+        backoff_ms *= 2;
+    }
+    if (backoff_ms > RETRY_MAX_MS) {
+        backoff_ms = RETRY_MAX_MS;
+    }
+    return backoff_ms * 500L + (long) (erand48(ctx->rand_state) * backoff_ms * 500.0);
+}
+
+/*
+ * Collect the result of a finished transfer. The first good response for a
+ * job wins and aborts its sibling; a failed job is retried after a backoff
+ * until it runs out of attempts
+ */
+void finish_transfer(verifier_context *ctx, CURLMsg *msg, request_slot *slot) {
+    CURL *eh = msg->easy_handle;
+    request_job *job = slot->job;
+    long response_code = 0;
+    int verified = 0;
+    int retryable = 1;
+    int ok = 0;
+
+    curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &response_code);
+    request_stats_record(ctx->interval, eh, msg->data.result, response_code, job->num_puzzles,
+                         slot->first_byte_us < 0 ? -1 : slot->first_byte_us - slot->start_us,
+                         now_us() - slot->start_us);
+    if (msg->data.result != CURLE_OK) {
+        fprintf(stderr, "CURL error code: %d\n", msg->data.result);
+    } else if (response_code != 200) {
+        fprintf(stderr, "Error in HTTP request; HTTP code %lu received.\n", response_code);
+        /* A client error will not go away on its own */
+        retryable = response_code >= 500;
+    } else if (ctx->batch_size == 1) {
+        verified = atoi(slot->response) != 0;
+        job->verdicts[0] = verified;
+        ok = 1;
+    } else if ((verified = parse_batch_response(slot->response, job->num_puzzles, job->verdicts)) < 0) {
+        fprintf(stderr, "Malformed batch response: %s\n", slot->response);
+    } else {
+        ok = 1;
+    }
+
+    int won_as_hedge = slot->hedge;
+    drop_transfer(ctx, slot);
+    long now = now_us();
+    long latency_us = now - job->attempt_start_us;
+
+    if (ok) {
+        while (job->num_transfers > 0) {
+            drop_transfer(ctx, job->transfers[0]);
+        }
+        ctx->num_hedge_wins += won_as_hedge;
+        histogram_record(ctx->latencies, (uint64_t) latency_us);
+        aimd_on_complete(&ctx->controller, job->seq, latency_us / 1000.0, 0, now);
+        ctx->num_verified += verified;
+        for (int i = 0; i < job->num_puzzles; i++) {
+            cache_insert(ctx->cache, job->keys[i], job->verdicts[i]);
+        }
+        release_job(ctx, job);
+        return;
+    }
+
+    /* Its hedge may still come through */
+    if (job->num_transfers > 0) {
+        return;
+    }
+
+    aimd_on_complete(&ctx->controller, job->seq, latency_us / 1000.0, 1, now);
+    job->generation++;
+    if (retryable && job->attempt < ctx->max_retries) {
+        job->attempt++;
+        ctx->num_retries++;
+        push_timer(ctx, job, now + retry_backoff_us(ctx, job->attempt));
+    } else {
+        fprintf(stderr, "Giving up on %d puzzles after %d attempts.\n", job->num_puzzles, job->attempt + 1);
+        ctx->num_unverified += job->num_puzzles;
+        release_job(ctx, job);
+    }
+}
+
+/*
+ * Load new batches into idle jobs until the controller's window is full or
+ * the input runs out
+ */
+void fill_window(verifier_context *ctx) {
+    while (ctx->num_in_flight < aimd_window(&ctx->controller) && ctx->num_idle_jobs > 0) {
+        request_job *job = ctx->idle_jobs[ctx->num_idle_jobs - 1];
+        if (!load_job(ctx, job)) {
             return;
         }
-        curl_multi_perform(cm, &still_running);
-    } while(still_running);
+        ctx->num_idle_jobs--;
+        ctx->num_in_flight++;
+        job->attempt = 0;
+        start_attempt(ctx, job);
+    }
+}
 
+/*
+ * Drain completed transfers; finished jobs are immediately refilled with
+ * the next puzzles so the window stays full until EOF
+ */
+void check_multi_info(verifier_context *ctx) {
     int msgs_left = 0;
-    CURL *eh = NULL;
     CURLMsg *msg = NULL;
-    CURLcode return_code = 0;
-    long response_code;
-
-    while ((msg = curl_multi_info_read(cm, &msgs_left))) {
-        if (msg->msg == CURLMSG_DONE) {
-            eh = msg->easy_handle;
-            return_code = msg->data.result;
-            if (return_code != CURLE_OK) {
-                fprintf(stderr, "CURL error code: %d\n", return_code);
+    while ((msg = curl_multi_info_read(ctx->cm, &msgs_left))) {
+        if (msg->msg != CURLMSG_DONE) {
+            fprintf(stderr, "error: after curl_multi_info_read, CURLMsg=%d\n", msg->msg);
+            continue;
+        }
+        request_slot *slot = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &slot);
+        finish_transfer(ctx, msg, slot);
+    }
+    fill_window(ctx);
+}
+
+/*
+ * Print and fold the interim statistics into the totals if the report
+ * interval has elapsed
+ */
+void maybe_report(verifier_context *ctx) {
+    if (ctx->report_interval_us == 0) {
+        return;
+    }
+    long now = now_us();
+    if (now < ctx->next_report_us) {
+        return;
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "interval, shard %d", ctx->id);
+    request_stats_print(ctx->interval, stderr, label, now);
+    request_stats_merge(ctx->totals, ctx->interval);
+    request_stats_reset(ctx->interval, now);
+    ctx->next_report_us = now + ctx->report_interval_us;
+}
+
+/* Shorten an epoll timeout so the loop wakes up by the given deadline */
+int bound_wait_ms(int wait_ms, long deadline_us) {
+    long remaining = (deadline_us - now_us() + 999) / 1000;
+    if (remaining < 0) {
+        remaining = 0;
+    }
+    return wait_ms < 0 || remaining < wait_ms ? (int) remaining : wait_ms;
+}
+
+/*
+ * Event loop: wait on epoll for socket readiness, cURL's timer or a job
+ * timer and hand each event to curl_multi_socket_action; runs until every
+ * job has finished
+ */
+void verify(verifier_context *ctx) {
+    struct epoll_event events[MAX_EVENTS];
+    int running = 0;
+
+    while (ctx->num_in_flight > 0) {
+        int wait_ms = -1;
+        if (ctx->timer_deadline >= 0) {
+            long remaining = ctx->timer_deadline - now_ms();
+            wait_ms = remaining > 0 ? (int) remaining : 0;
+        }
+        if (ctx->num_timers > 0) {
+            wait_ms = bound_wait_ms(wait_ms, ctx->timers[0].due_us);
+        }
+        if (ctx->report_interval_us > 0) {
+            /* Wake up for interim reports even when the server goes quiet */
+            wait_ms = bound_wait_ms(wait_ms, ctx->next_report_us);
+        }
+
+        int n = epoll_wait(ctx->epfd, events, MAX_EVENTS, wait_ms);
+        if (n < 0) {
+            if (errno == EINTR) {
                 continue;
             }
-            curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &response_code);
+            perror("epoll_wait");
+            return;
+        }
 
-            if (response_code != 200) {
-                fprintf(stderr, "Error in HTTP request; HTTP code %lu received.\n", response_code);
+        for (int i = 0; i < n; i++) {
+            int mask = 0;
+            if (events[i].events & EPOLLIN) {
+                mask |= CURL_CSELECT_IN;
+            }
+            if (events[i].events & EPOLLOUT) {
+                mask |= CURL_CSELECT_OUT;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                mask |= CURL_CSELECT_ERR;
             }
-            curl_multi_remove_handle(cm, eh);
+            curl_multi_socket_action(ctx->cm, events[i].data.fd, mask, &running);
         }
-        else {
-            fprintf(stderr, "error: after curl_multi_info_read, CURLMsg=%d\n", msg->msg);
+
+        if (ctx->timer_deadline >= 0 && now_ms() >= ctx->timer_deadline) {
+            ctx->timer_deadline = -1;
+            curl_multi_socket_action(ctx->cm, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+
+        check_multi_info(ctx);
+        fire_timers(ctx);
+        maybe_report(ctx);
+    }
+}
+
+/* Raise the open file limit so thousands of sockets can be in flight */
+void raise_fd_limit(int num_connections) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        return;
+    }
+    rlim_t wanted = (rlim_t) num_connections + 64;
+    if (rl.rlim_cur < wanted) {
+        rl.rlim_cur = rl.rlim_max < wanted ? rl.rlim_max : wanted;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur < wanted) {
+            fprintf(stderr, "warning: open file limit %lu is below %lu; connections may fail\n",
+                    (unsigned long) rl.rlim_cur, (unsigned long) wanted);
         }
     }
 }
@@ -76,8 +473,17 @@ int main(int argc, char **argv) {
     /* Parse arguments */
     int c;
     int num_connections = 1;
+    int batch_size = 1;
+    int adaptive = 0;
+    int hedging = 0;
+    int num_threads = 1;
+    int max_retries = MAX_RETRIES;
+    long timeout_ms = TIMEOUT_MS;
+    long report_interval = REPORT_INTERVAL;
     char* filename = NULL;
-    while ((c = getopt(argc, argv, "t:i:")) != -1) {
+    char* cache_file = NULL;
+    char* url = URL;
+    while ((c = getopt(argc, argv, "t:i:b:u:ar:T:R:Hn:C:")) != -1) {
         switch (c) {
             case 't':
                 num_connections = strtoul(optarg, NULL, 10);
@@ -89,6 +495,44 @@ int main(int argc, char **argv) {
             case 'i':
                 filename = optarg;
                 break;
+            case 'b':
+                batch_size = strtoul(optarg, NULL, 10);
+                if (batch_size == 0) {
+                    printf("%s: option requires an argument > 0 -- 'b'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'u':
+                url = optarg;
+                break;
+            case 'a':
+                /* -t becomes the upper bound of an adaptive window */
+                adaptive = 1;
+                break;
+            case 'r':
+                report_interval = strtol(optarg, NULL, 10);
+                break;
+            case 'T':
+                timeout_ms = strtol(optarg, NULL, 10);
+                break;
+            case 'R':
+                max_retries = strtol(optarg, NULL, 10);
+                break;
+            case 'H':
+                /* Duplicate requests that outlive the observed p95 latency */
+                hedging = 1;
+                break;
+            case 'C':
+                /* Persist the cache across runs */
+                cache_file = optarg;
+                break;
+            case 'n':
+                num_threads = strtoul(optarg, NULL, 10);
+                if (num_threads == 0) {
+                    printf("%s: option requires an argument > 0 -- 'n'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
             default:
                 return -1;
         }
@@ -101,126 +545,252 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
+    /* Every shard needs at least one connection */
+    if (num_threads > num_connections) {
+        num_threads = num_connections;
+    }
+    raise_fd_limit(hedging ? 2 * num_connections : num_connections);
     curl_global_init(CURL_GLOBAL_ALL);
-
-    /* Setup curl and curl multi handlers */
-    CURLM *cm = curl_multi_init();
-    CURL *easy_handles[num_connections];
-    int *results[num_connections];
+    init_locks();
     struct curl_slist *headers = config_headers();
+    verify_cache *cache = cache_create();
+    if (cache_file != NULL && cache_load(cache, cache_file) < 0) {
+        fprintf(stderr, "No cache at %s yet; it will be created.\n", cache_file);
+    }
 
-    for (int i = 0; i < num_connections; i++) {
-        results[i] = (int*) malloc(sizeof(int));
-        *results[i] = 0;
-        CURL *eh = create_eh(results[i], headers);
-        easy_handles[i] = eh;
+    /* Split the connections across the shards and start them */
+    verifier_context *shards = calloc(num_threads, sizeof(verifier_context));
+    pthread_t tids[num_threads];
+    long seed = now_us();
+    for (int i = 0; i < num_threads; i++) {
+        verifier_context *ctx = &shards[i];
+        ctx->id = i;
+        ctx->url = url;
+        ctx->headers = headers;
+        ctx->num_connections = num_connections / num_threads + (i < num_connections % num_threads);
+        ctx->adaptive = adaptive;
+        ctx->timeout_ms = timeout_ms;
+        ctx->inputfile = inputfile;
+        ctx->batch_size = batch_size;
+        ctx->cache = cache;
+        ctx->max_retries = max_retries > 0 ? max_retries : 0;
+        ctx->hedging = hedging;
+        ctx->rand_state[0] = (unsigned short) seed;
+        ctx->rand_state[1] = (unsigned short) (seed >> 16);
+        ctx->rand_state[2] = (unsigned short) i;
+        ctx->report_interval_us = report_interval > 0 ? report_interval * 1000000L : 0;
+        pthread_create(&tids[i], NULL, verify_shard, ctx);
     }
 
-    /* Initialize variables for puzzle checking */
+    /* Merge the shards' results */
+    request_stats *totals = request_stats_create(now_us());
     int num_verified = 0;
     int num_total_puzzles = 0;
-    int num_available_puzzles = 0;
-    int num_puzzles_to_free_separately = num_connections;
-    char **json_puzzles = malloc(num_connections*sizeof(char*));
-    puzzle *p;
-
-    /* Perform puzzle checking */
-    while ((p = read_next_puzzle(inputfile)) != NULL) {
-        /* Logic to setup and send requests with data*/
-        if (num_available_puzzles >= num_connections) {
-            for (int i = 0; i < num_available_puzzles; i++) {
-                curl_easy_setopt(easy_handles[i], CURLOPT_READDATA, json_puzzles[i]);
-                curl_multi_add_handle(cm, easy_handles[i]);
-            }
-            verify(cm);
-            for (int i = 0; i < num_available_puzzles; i++) {
-                num_verified += *results[i]; 
-                *results[i] = 0;
-            }
-            num_available_puzzles = 0;
-        }
-
-        json_puzzles[num_available_puzzles % num_connections] = convert_to_json(p);
-        num_available_puzzles++;
-        num_total_puzzles++;
-        free(p);
+    int num_unverified = 0;
+    long num_retries = 0;
+    long num_hedges = 0;
+    long num_hedge_wins = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(tids[i], NULL);
+        request_stats_merge(totals, shards[i].totals);
+        num_verified += shards[i].num_verified;
+        num_total_puzzles += shards[i].num_total_puzzles;
+        num_unverified += shards[i].num_unverified;
+        num_retries += shards[i].num_retries;
+        num_hedges += shards[i].num_hedges;
+        num_hedge_wins += shards[i].num_hedge_wins;
+        free(shards[i].totals);
     }
 
-    /* Take care of leftover puzzles*/
-    /* Logic to setup and send requests with data*/
-    if (num_available_puzzles > 0) {
-        for (int i = 0; i < num_available_puzzles; i++) {
-            curl_easy_setopt(easy_handles[i], CURLOPT_READDATA, json_puzzles[i]);
-            curl_multi_add_handle(cm, easy_handles[i]);
-        }
-        verify(cm);
-        for (int i = 0; i < num_available_puzzles; i++) {
-            num_verified += *results[i];
-            *results[i] = 0;
-        }
-        if (num_available_puzzles == num_total_puzzles) {
-            num_puzzles_to_free_separately = num_available_puzzles;
-        }
-        num_available_puzzles = 0;
+    request_stats_print(totals, stderr, "total", now_us());
+    fprintf(stderr, "    retries: %ld; hedges: %ld (%ld won); unverified puzzles: %d\n",
+            num_retries, num_hedges, num_hedge_wins, num_unverified);
+    cache_print(cache, stderr);
+    if (cache_file != NULL && cache_save(cache, cache_file) < 0) {
+        fprintf(stderr, "Unable to save the cache to %s.\n", cache_file);
     }
-
     printf("%d of %d puzzles passed verification.\n", num_verified, num_total_puzzles);
 
     /* Cleanup */
-    for (int i = 0; i < num_connections; i++) {
-        free(results[i]);
-        curl_easy_cleanup(easy_handles[i]);
-    }
-    for (int i = 0; i < num_puzzles_to_free_separately; i++) {
-        free(json_puzzles[i]);
-    }
-    free(json_puzzles);
+    cache_delete(cache);
+    free(totals);
+    free(shards);
     curl_slist_free_all(headers);
-    curl_multi_cleanup(cm);
     curl_global_cleanup();
     fclose( inputfile );
     return 0;
 }
 
-char *convert_to_json(puzzle *p) {
-    char *rows[9];
-    for (int i = 0; i < 9; i++) {
-        rows[i] = malloc(ROW_LENGTH);
-        memset(rows[i], 0, ROW_LENGTH);
-        int written = sprintf(rows[i], ROW_FORMAT,
-                              p->content[i][0], p->content[i][1], p->content[i][2],
-                              p->content[i][3], p->content[i][4], p->content[i][5],
-                              p->content[i][6], p->content[i][7], p->content[i][8]);
-        if (written != ROW_LENGTH - 1) {
-            printf("Something went wrong when writing row; expected to write %d but wrote %d...\n",
-                    ROW_LENGTH -1, written);
+/*
+ * Set up the shard's event loop, multi handle, jobs and easy handles, then
+ * verify until the shared input runs out. The shard's totals are left in
+ * ctx->totals for main to merge
+ */
+void *verify_shard(void *arg) {
+    verifier_context *ctx = (verifier_context*) arg;
+
+    /* A hedged job can hold a second easy handle */
+    int num_jobs = ctx->num_connections;
+    int num_slots = ctx->hedging ? 2 * num_jobs : num_jobs;
+
+    ctx->timer_deadline = -1;
+    ctx->read_buffer = malloc(ctx->batch_size * sizeof(puzzle));
+    ctx->latencies = malloc(sizeof(histogram));
+    histogram_reset(ctx->latencies);
+    ctx->totals = request_stats_create(now_us());
+    ctx->interval = request_stats_create(now_us());
+    ctx->next_report_us = now_us() + ctx->report_interval_us;
+    ctx->epfd = epoll_create1(0);
+    if (ctx->epfd < 0) {
+        perror("epoll_create1");
+    }
+    ctx->cm = curl_multi_init();
+    curl_multi_setopt(ctx->cm, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(ctx->cm, CURLMOPT_SOCKETDATA, ctx);
+    curl_multi_setopt(ctx->cm, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(ctx->cm, CURLMOPT_TIMERDATA, ctx);
+    curl_multi_setopt(ctx->cm, CURLMOPT_MAXCONNECTS, (long) num_slots);
+
+    request_job *jobs = calloc(num_jobs, sizeof(request_job));
+    request_slot *slots = calloc(num_slots, sizeof(request_slot));
+    ctx->idle_jobs = malloc(num_jobs * sizeof(request_job*));
+    ctx->idle_slots = malloc(num_slots * sizeof(request_slot*));
+    aimd_init(&ctx->controller, ctx->adaptive, num_jobs, now_us(), stderr);
+
+    for (int i = 0; i < num_jobs; i++) {
+        if (ctx->batch_size == 1) {
+            jobs[i].body = malloc(PUZZLE_JSON_LENGTH + 1);
+            init_puzzle_json(jobs[i].body);
+        } else {
+            jobs[i].body = malloc(BATCH_JSON_LENGTH(ctx->batch_size) + 1);
+            init_batch_json(jobs[i].body, ctx->batch_size);
         }
+        jobs[i].keys = malloc(ctx->batch_size * sizeof(uint64_t));
+        jobs[i].verdicts = malloc(ctx->batch_size);
+        ctx->idle_jobs[ctx->num_idle_jobs++] = &jobs[num_jobs - 1 - i];
     }
-    char *json = malloc(MATRIX_LENGTH);
-    memset(json, 0, MATRIX_LENGTH);
-    int written = sprintf(json, MATRIX_FORMAT,
-                          rows[0], rows[1], rows[2], rows[3], rows[4],
-                          rows[5], rows[6], rows[7], rows[8]);
-    if (written != MATRIX_LENGTH - 1) {
-        printf("Something went wrong when writing matrix; expected to write %d but wrote %d...\n",
-               MATRIX_LENGTH -1, written);
+    for (int i = 0; i < num_slots; i++) {
+        /* Room for "[1,0,...]" plus slack for a short error message */
+        slots[i].response_capacity = 2 * ctx->batch_size + 64;
+        slots[i].response = malloc(slots[i].response_capacity + 1);
+        slots[i].eh = create_eh(&slots[i], ctx->headers, ctx->url, ctx->timeout_ms);
+        ctx->idle_slots[ctx->num_idle_slots++] = &slots[num_slots - 1 - i];
     }
-    for (int i = 0; i < 9; i++) {
-        free(rows[i]);
+
+    /* Fill the initial window, then run the loop. A shard without an event
+     * loop leaves the shared input to the others and only cleans up */
+    if (ctx->epfd >= 0) {
+        fill_window(ctx);
+        verify(ctx);
+    }
+    request_stats_merge(ctx->totals, ctx->interval);
+
+    /* Cleanup */
+    for (int i = 0; i < num_slots; i++) {
+        curl_multi_remove_handle(ctx->cm, slots[i].eh);
+        curl_easy_cleanup(slots[i].eh);
+        free(slots[i].response);
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        free(jobs[i].body);
+        free(jobs[i].keys);
+        free(jobs[i].verdicts);
+    }
+    free(jobs);
+    free(slots);
+    free(ctx->idle_jobs);
+    free(ctx->idle_slots);
+    free(ctx->timers);
+    free(ctx->latencies);
+    free(ctx->interval);
+    free(ctx->read_buffer);
+    curl_multi_cleanup(ctx->cm);
+    if (ctx->epfd >= 0) {
+        close(ctx->epfd);
+    }
+    return NULL;
+}
+
+void push_timer(verifier_context *ctx, request_job *job, long due_us) {
+    if (ctx->num_timers == ctx->timers_capacity) {
+        ctx->timers_capacity = ctx->timers_capacity * 2 + 64;
+        ctx->timers = realloc(ctx->timers, ctx->timers_capacity * sizeof(job_timer));
+    }
+    job_timer timer = { due_us, job, job->generation };
+    int i = ctx->num_timers++;
+    while (i > 0 && ctx->timers[(i - 1) / 2].due_us > due_us) {
+        ctx->timers[i] = ctx->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    ctx->timers[i] = timer;
+}
+
+void fire_timers(verifier_context *ctx) {
+    long now = now_us();
+    while (ctx->num_timers > 0 && ctx->timers[0].due_us <= now) {
+        job_timer timer = ctx->timers[0];
+
+        /* Pop the heap root */
+        job_timer last = ctx->timers[--ctx->num_timers];
+        int i = 0;
+        for (;;) {
+            int child = 2 * i + 1;
+            if (child >= ctx->num_timers) {
+                break;
+            }
+            if (child + 1 < ctx->num_timers && ctx->timers[child + 1].due_us < ctx->timers[child].due_us) {
+                child++;
+            }
+            if (ctx->timers[child].due_us >= last.due_us) {
+                break;
+            }
+            ctx->timers[i] = ctx->timers[child];
+            i = child;
+        }
+        if (ctx->num_timers > 0) {
+            ctx->timers[i] = last;
+        }
+
+        request_job *job = timer.job;
+        if (timer.generation != job->generation) {
+            continue;
+        }
+        if (job->num_transfers == 0) {
+            /* Backoff is over */
+            start_attempt(ctx, job);
+        } else if (job->num_transfers == 1 && start_transfer(ctx, job)) {
+            ctx->num_hedges++;
+        }
     }
-    return json;
 }
 
+/*
+ * Stream the job's body, as much as cURL has room for; a body larger than
+ * cURL's upload buffer is sent over several calls
+ */
 size_t read_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
-    memcpy(buffer, userdata, MATRIX_LENGTH);
-    return MATRIX_LENGTH;
+    request_slot *slot = (request_slot*) userdata;
+    size_t remaining = slot->job->body_length - slot->body_offset;
+    size_t to_copy = size * nitems < remaining ? size * nitems : remaining;
+    memcpy(buffer, slot->job->body + slot->body_offset, to_copy);
+    slot->body_offset += to_copy;
+    return to_copy;
 }
 
 size_t write_callback(char *ptr, size_t size, size_t nmemb, void  *userdata) {
-    printf("Write callback message from server: %s\n", ptr);
-    int * p = (int*) userdata;
-    *p = atoi(ptr);
-    return size * nmemb;
+    request_slot *slot = (request_slot*) userdata;
+    size_t length = size * nmemb;
+    if (slot->first_byte_us < 0) {
+        slot->first_byte_us = now_us();
+    }
+
+    /* Responses may arrive in pieces; accumulate them for finish_request */
+    size_t room = slot->response_capacity - slot->response_length;
+    size_t to_copy = length < room ? length : room;
+    memcpy(slot->response + slot->response_length, ptr, to_copy);
+    slot->response_length += to_copy;
+    slot->response[slot->response_length] = '\0';
+    return length;
 }
 
 struct curl_slist *config_headers() {
@@ -230,16 +800,61 @@ struct curl_slist *config_headers() {
     return headers;
 }
 
-CURL *create_eh(const int *result, const struct curl_slist *headers) {
+CURL *create_eh(request_slot *slot, const struct curl_slist *headers, const char *url, long timeout_ms) {
     CURL *eh = curl_easy_init();
+    curl_easy_setopt(eh, CURLOPT_PRIVATE, slot);
     curl_easy_setopt(eh, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(eh, CURLOPT_URL, URL);
+    curl_easy_setopt(eh, CURLOPT_URL, url);
     curl_easy_setopt(eh, CURLOPT_POST, 1L);
     curl_easy_setopt(eh, CURLOPT_READFUNCTION, read_callback);
+    curl_easy_setopt(eh, CURLOPT_READDATA, slot);
     curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(eh, CURLOPT_WRITEDATA, result);
-    curl_easy_setopt(eh, CURLOPT_POSTFIELDSIZE, MATRIX_LENGTH);
+    curl_easy_setopt(eh, CURLOPT_WRITEDATA, slot);
+    curl_easy_setopt(eh, CURLOPT_TIMEOUT_MS, timeout_ms);
+    /* Timeouts must not rely on signals once several shards are running */
+    curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1L);
     return eh;
 }
 
+int socket_callback(CURL *eh, curl_socket_t s, int what, void *userp, void *socketp) {
+    verifier_context *ctx = (verifier_context*) userp;
+    (void) eh;
 
+    if (what == CURL_POLL_REMOVE) {
+        /* The socket may already be closed, in which case epoll dropped it */
+        epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, s, NULL);
+        curl_multi_assign(ctx->cm, s, NULL);
+        return 0;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = s;
+    if (what & CURL_POLL_IN) {
+        ev.events |= EPOLLIN;
+    }
+    if (what & CURL_POLL_OUT) {
+        ev.events |= EPOLLOUT;
+    }
+
+    /* socketp is non-NULL once we have registered this socket with epoll */
+    if (socketp == NULL) {
+        if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, s, &ev) != 0
+                && (errno != EEXIST || epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, s, &ev) != 0)) {
+            perror("epoll_ctl ADD");
+            return -1;
+        }
+        curl_multi_assign(ctx->cm, s, ctx);
+    } else if (epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, s, &ev) != 0) {
+        perror("epoll_ctl MOD");
+        return -1;
+    }
+    return 0;
+}
+
+int timer_callback(CURLM *cm, long timeout_ms, void *userp) {
+    verifier_context *ctx = (verifier_context*) userp;
+    (void) cm;
+    ctx->timer_deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+    return 0;
+}
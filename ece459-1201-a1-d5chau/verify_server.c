@@ -0,0 +1,665 @@
+/*
+ * A local stand-in for the verification service. Accepts the same
+ * `POST /verify` requests as the course server, over HTTP/1.1 with
+ * keep-alive, and answers from a single epoll loop.
+ *
+ * Request bodies come in two shapes:
+ *   {"content":[[...],...]}        one grid; the response body is 1 or 0
+ *   {"batch":[[[...],...],...]}    many grids; the response body is a JSON
+ *                                  array holding 1 or 0 for every grid, in
+ *                                  request order
+ *
+ * To make client tuning meaningful on one machine, the server can pretend
+ * to be a slow and unreliable service:
+ *   -l <ms>    base service latency of every request
+ *   -j <ms>    extra uniformly distributed latency in [0, jitter)
+ *   -e <rate>  fraction of requests answered with HTTP 500 instead
+ *   -c <n>     requests serviced at once; the rest wait in FIFO order
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "common.h"
+
+/* Check the common header for the definition of puzzle */
+
+#define DEFAULT_PORT 4590
+#define MAX_EVENTS 256
+#define READ_CHUNK 16384
+#define MAX_REQUEST_LENGTH (64 * 1024 * 1024)
+
+/* State of one client connection */
+typedef struct connection {
+    int fd;
+    char *in;           /* Bytes received but not yet consumed */
+    size_t in_length;
+    size_t in_capacity;
+    char *out;          /* Response being written, or held until due */
+    size_t out_length;
+    size_t out_offset;
+    int close_after_write;
+    int waiting;        /* Response is held back until its service time */
+    int closed;         /* Peer went away while a response was held back */
+    long due_us;
+    struct connection *next_queued;
+} connection;
+
+/* Configuration and event loop state */
+typedef struct {
+    int epfd;
+    double latency_ms;
+    double jitter_ms;
+    double error_rate;
+    int max_concurrency;        /* 0 means unlimited */
+    int in_service;
+    connection **timers;        /* Binary min-heap ordered by due_us */
+    int num_timers;
+    int timers_capacity;
+    connection *queue_head;     /* Requests waiting for a service slot */
+    connection *queue_tail;
+} server_state;
+
+/* Create the listening socket */
+int open_listener(int port);
+
+/* Set O_NONBLOCK on a descriptor */
+int set_nonblocking(int fd);
+
+/* Current value of the monotonic clock in microseconds */
+long now_us();
+
+/* Accept every pending connection on the listener */
+void accept_connections(server_state *server, int listener);
+
+/* Read what is available and answer any complete request */
+int on_readable(server_state *server, connection *conn);
+
+/* Write as much of the pending response as the socket takes */
+int on_writable(server_state *server, connection *conn);
+
+/* Parse one complete request from the input buffer and queue its response;
+ * returns 1 if a request was handled, 0 if more bytes are needed, -1 on error */
+int handle_request(server_state *server, connection *conn);
+
+/* Build the response body for a request body */
+char *verify_body(const char *body, size_t length, int *status);
+
+/* Prepare a full HTTP response on the connection */
+void queue_response(connection *conn, int status, const char *body);
+
+/* Hold a prepared response until its simulated service time has elapsed;
+ * without one it is left ready for the caller to write */
+void schedule_response(server_state *server, connection *conn);
+
+/* Start the service timer of a request */
+void start_service(server_state *server, connection *conn);
+
+/* Release every response whose service time has elapsed */
+void fire_timers(server_state *server);
+
+/* Milliseconds until the next response is due, -1 if none */
+int next_timeout_ms(server_state *server);
+
+/* Release a connection and its buffers */
+void close_connection(server_state *server, connection *conn);
+
+/* Stop polling a connection with a held response; it is freed when due */
+void abandon_connection(server_state *server, connection *conn);
+
+int main(int argc, char **argv) {
+    /* Parse arguments */
+    int c;
+    int port = DEFAULT_PORT;
+    server_state server;
+    memset(&server, 0, sizeof(server));
+    while ((c = getopt(argc, argv, "p:l:j:e:c:")) != -1) {
+        switch (c) {
+            case 'p':
+                port = strtoul(optarg, NULL, 10);
+                if (port <= 0 || port > 65535) {
+                    printf("%s: option requires a port number -- 'p'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                server.latency_ms = strtod(optarg, NULL);
+                if (server.latency_ms < 0) {
+                    printf("%s: option requires an argument >= 0 -- 'l'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                server.jitter_ms = strtod(optarg, NULL);
+                if (server.jitter_ms < 0) {
+                    printf("%s: option requires an argument >= 0 -- 'j'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'e':
+                server.error_rate = strtod(optarg, NULL);
+                if (server.error_rate < 0 || server.error_rate > 1) {
+                    printf("%s: option requires an argument between 0 and 1 -- 'e'\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                server.max_concurrency = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    srand48(time(NULL));
+
+    int listener = open_listener(port);
+    if (listener < 0) {
+        return EXIT_FAILURE;
+    }
+
+    server.epfd = epoll_create1(0);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* NULL marks the listener */
+    epoll_ctl(server.epfd, EPOLL_CTL_ADD, listener, &ev);
+
+    printf("Listening on port %d (latency %.1f ms, jitter %.1f ms, error rate %.3f, max concurrency %d)\n",
+           port, server.latency_ms, server.jitter_ms, server.error_rate, server.max_concurrency);
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int n = epoll_wait(server.epfd, events, MAX_EVENTS, next_timeout_ms(&server));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            connection *conn = (connection*) events[i].data.ptr;
+            if (conn == NULL) {
+                accept_connections(&server, listener);
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_connection(&server, conn);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && on_writable(&server, conn) < 0) {
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                on_readable(&server, conn);
+            }
+        }
+        fire_timers(&server);
+    }
+
+    close(listener);
+    close(server.epfd);
+    free(server.timers);
+    return 0;
+}
+
+int open_listener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) != 0 || set_nonblocking(fd) != 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+void accept_connections(server_state *server, int listener) {
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("accept");
+            }
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        set_nonblocking(fd);
+
+        connection *conn = calloc(1, sizeof(connection));
+        conn->fd = fd;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            perror("epoll_ctl ADD");
+            close(fd);
+            free(conn);
+        }
+    }
+}
+
+int on_readable(server_state *server, connection *conn) {
+    for (;;) {
+        if (conn->in_capacity - conn->in_length < READ_CHUNK) {
+            conn->in_capacity = conn->in_capacity * 2 + READ_CHUNK;
+            conn->in = realloc(conn->in, conn->in_capacity + 1);
+        }
+        ssize_t got = read(conn->fd, conn->in + conn->in_length, conn->in_capacity - conn->in_length);
+        if (got > 0) {
+            conn->in_length += got;
+            continue;
+        }
+        if (got == 0) {
+            /* Peer closed; finish a partly written response, drop the rest */
+            if (conn->out == NULL || conn->waiting) {
+                close_connection(server, conn);
+                return -1;
+            }
+            conn->close_after_write = 1;
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLOUT;
+            ev.data.ptr = conn;
+            epoll_ctl(server->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        close_connection(server, conn);
+        return -1;
+    }
+
+    /* Requests on one connection are answered strictly in order */
+    if (conn->out == NULL) {
+        int handled = handle_request(server, conn);
+        if (handled < 0) {
+            close_connection(server, conn);
+            return -1;
+        }
+        if (handled > 0 && !conn->waiting) {
+            return on_writable(server, conn);
+        }
+    }
+    return 0;
+}
+
+int on_writable(server_state *server, connection *conn) {
+    while (conn->out != NULL && !conn->waiting) {
+        while (conn->out_offset < conn->out_length) {
+            ssize_t sent = write(conn->fd, conn->out + conn->out_offset, conn->out_length - conn->out_offset);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    struct epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN | EPOLLOUT;
+                    ev.data.ptr = conn;
+                    epoll_ctl(server->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+                    return 0;
+                }
+                close_connection(server, conn);
+                return -1;
+            }
+            conn->out_offset += sent;
+        }
+        free(conn->out);
+        conn->out = NULL;
+
+        if (conn->close_after_write) {
+            close_connection(server, conn);
+            return -1;
+        }
+
+        /* A pipelining client may already have sent the next request */
+        int handled = handle_request(server, conn);
+        if (handled < 0) {
+            close_connection(server, conn);
+            return -1;
+        }
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(server->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    return 0;
+}
+
+int handle_request(server_state *server, connection *conn) {
+    if (conn->in_length == 0) {
+        return 0;
+    }
+    conn->in[conn->in_length] = '\0';
+    char *header_end = strstr(conn->in, "\r\n\r\n");
+    if (header_end == NULL) {
+        return conn->in_length > MAX_REQUEST_LENGTH ? -1 : 0;
+    }
+    size_t header_length = header_end + 4 - conn->in;
+
+    /* Request line */
+    char method[16];
+    char path[256];
+    char version[16];
+    if (sscanf(conn->in, "%15s %255s %15s", method, path, version) != 3) {
+        return -1;
+    }
+
+    /* Headers we care about */
+    size_t content_length = 0;
+    int close_requested = strcmp(version, "HTTP/1.0") == 0;
+    char *line = strstr(conn->in, "\r\n") + 2;
+    while (line < header_end) {
+        char *next = strstr(line, "\r\n");
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            content_length = strtoul(line + 15, NULL, 10);
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            char *value = line + 11;
+            while (*value == ' ') {
+                value++;
+            }
+            if (strncasecmp(value, "close", 5) == 0) {
+                close_requested = 1;
+            } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+                close_requested = 0;
+            }
+        }
+        line = next + 2;
+    }
+
+    if (content_length > MAX_REQUEST_LENGTH) {
+        return -1;
+    }
+    if (conn->in_length < header_length + content_length) {
+        return 0;
+    }
+
+    int status = 200;
+    char *body = NULL;
+    if (strcmp(path, "/verify") != 0) {
+        status = 404;
+    } else if (strcmp(method, "POST") != 0) {
+        status = 405;
+    } else if (server->error_rate > 0 && drand48() < server->error_rate) {
+        status = 500;
+    } else {
+        body = verify_body(conn->in + header_length, content_length, &status);
+    }
+    conn->close_after_write = close_requested;
+    queue_response(conn, status, body != NULL ? body : "");
+    free(body);
+
+    /* Drop the consumed request, keeping anything pipelined behind it */
+    size_t consumed = header_length + content_length;
+    memmove(conn->in, conn->in + consumed, conn->in_length - consumed);
+    conn->in_length -= consumed;
+
+    schedule_response(server, conn);
+    return 1;
+}
+
+char *verify_body(const char *body, size_t length, int *status) {
+    const char *end = body + length;
+    int is_batch = 0;
+    const char *cursor = body;
+
+    /* The first key decides the shape of the request */
+    const char *key = memchr(body, '"', length);
+    if (key != NULL && end - key >= 7 && strncmp(key, "\"batch\"", 7) == 0) {
+        is_batch = 1;
+        cursor = key + 7;
+    } else if (key != NULL && end - key >= 9 && strncmp(key, "\"content\"", 9) == 0) {
+        cursor = key + 9;
+    } else {
+        *status = 400;
+        return NULL;
+    }
+
+    /* Every grid is 81 numbers; anything that is not a digit is a separator */
+    size_t capacity = 64;
+    size_t num_grids = 0;
+    int *results = malloc(capacity * sizeof(int));
+    puzzle p;
+    int cell = 0;
+    while (cursor < end) {
+        if (*cursor < '0' || *cursor > '9') {
+            cursor++;
+            continue;
+        }
+        int value = 0;
+        while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+            value = value * 10 + (*cursor - '0');
+            cursor++;
+        }
+        p.content[cell / 9][cell % 9] = value;
+        if (++cell == 81) {
+            if (num_grids == capacity) {
+                capacity *= 2;
+                results = realloc(results, capacity * sizeof(int));
+            }
+            results[num_grids++] = is_solved(&p);
+            cell = 0;
+        }
+    }
+
+    if (cell != 0 || num_grids == 0 || (!is_batch && num_grids != 1)) {
+        free(results);
+        *status = 400;
+        return NULL;
+    }
+
+    char *response;
+    if (!is_batch) {
+        response = malloc(2);
+        response[0] = results[0] ? '1' : '0';
+        response[1] = '\0';
+    } else {
+        response = malloc(2 * num_grids + 2);
+        char *out = response;
+        *out++ = '[';
+        for (size_t i = 0; i < num_grids; i++) {
+            if (i > 0) {
+                *out++ = ',';
+            }
+            *out++ = results[i] ? '1' : '0';
+        }
+        *out++ = ']';
+        *out = '\0';
+    }
+    free(results);
+    *status = 200;
+    return response;
+}
+
+void queue_response(connection *conn, int status, const char *body) {
+    const char *reason = status == 200 ? "OK"
+                         : status == 400 ? "Bad Request"
+                         : status == 404 ? "Not Found"
+                         : status == 405 ? "Method Not Allowed"
+                         : "Internal Server Error";
+    size_t body_length = strlen(body);
+    size_t capacity = body_length + 256;
+    conn->out = malloc(capacity);
+    conn->out_length = snprintf(conn->out, capacity,
+                                "HTTP/1.1 %d %s\r\n"
+                                "Content-Type: application/json\r\n"
+                                "Content-Length: %zu\r\n"
+                                "%s"
+                                "\r\n"
+                                "%s",
+                                status, reason, body_length,
+                                conn->close_after_write ? "Connection: close\r\n" : "",
+                                body);
+    conn->out_offset = 0;
+}
+
+void schedule_response(server_state *server, connection *conn) {
+    if (server->latency_ms == 0 && server->jitter_ms == 0 && server->max_concurrency == 0) {
+        /* No simulated service time. The caller writes the response, so
+         * a pipeline of requests is drained by on_writable's loop rather
+         * than by recursion, and a connection closed while writing is
+         * only ever freed where nothing touches it again */
+        return;
+    }
+
+    conn->waiting = 1;
+    if (server->max_concurrency > 0 && server->in_service >= server->max_concurrency) {
+        conn->next_queued = NULL;
+        if (server->queue_tail != NULL) {
+            server->queue_tail->next_queued = conn;
+        } else {
+            server->queue_head = conn;
+        }
+        server->queue_tail = conn;
+        return;
+    }
+    start_service(server, conn);
+}
+
+void start_service(server_state *server, connection *conn) {
+    double service_ms = server->latency_ms + drand48() * server->jitter_ms;
+    conn->due_us = now_us() + (long) (service_ms * 1000.0);
+    server->in_service++;
+
+    if (server->num_timers == server->timers_capacity) {
+        server->timers_capacity = server->timers_capacity * 2 + 64;
+        server->timers = realloc(server->timers, server->timers_capacity * sizeof(connection*));
+    }
+    int i = server->num_timers++;
+    while (i > 0 && server->timers[(i - 1) / 2]->due_us > conn->due_us) {
+        server->timers[i] = server->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    server->timers[i] = conn;
+}
+
+void fire_timers(server_state *server) {
+    long now = now_us();
+    while (server->num_timers > 0 && server->timers[0]->due_us <= now) {
+        connection *conn = server->timers[0];
+
+        /* Pop the heap root */
+        connection *last = server->timers[--server->num_timers];
+        int i = 0;
+        for (;;) {
+            int child = 2 * i + 1;
+            if (child >= server->num_timers) {
+                break;
+            }
+            if (child + 1 < server->num_timers && server->timers[child + 1]->due_us < server->timers[child]->due_us) {
+                child++;
+            }
+            if (server->timers[child]->due_us >= last->due_us) {
+                break;
+            }
+            server->timers[i] = server->timers[child];
+            i = child;
+        }
+        if (server->num_timers > 0) {
+            server->timers[i] = last;
+        }
+
+        /* The freed service slot goes to the oldest queued request */
+        server->in_service--;
+        if (server->queue_head != NULL) {
+            connection *next = server->queue_head;
+            server->queue_head = next->next_queued;
+            if (server->queue_head == NULL) {
+                server->queue_tail = NULL;
+            }
+            start_service(server, next);
+        }
+
+        conn->waiting = 0;
+        if (conn->closed) {
+            close_connection(server, conn);
+        } else {
+            on_writable(server, conn);
+        }
+    }
+}
+
+int next_timeout_ms(server_state *server) {
+    if (server->num_timers == 0) {
+        return -1;
+    }
+    long remaining = server->timers[0]->due_us - now_us();
+    return remaining > 0 ? (int) ((remaining + 999) / 1000) : 0;
+}
+
+void close_connection(server_state *server, connection *conn) {
+    if (conn->waiting) {
+        abandon_connection(server, conn);
+        return;
+    }
+    if (!conn->closed) {
+        epoll_ctl(server->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+    }
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+void abandon_connection(server_state *server, connection *conn) {
+    if (!conn->closed) {
+        epoll_ctl(server->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->closed = 1;
+    }
+}
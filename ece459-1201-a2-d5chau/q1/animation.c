@@ -0,0 +1,346 @@
+/* Keyframed animation and the tiles each frame must re-render.
+ *
+ * The tracer has no shadow rays, so a pixel's colour depends only on the
+ * segments its primary and reflected rays travel, the spheres they end on
+ * and the lights. If no sphere that changed between two frames comes near
+ * any segment a tile traced in the first, every one of those rays ends
+ * where it did before, and unless a light changed too the tile is the
+ * same. Segments are clipped to the box every sphere stays in at every
+ * frame, which is cut into a grid of voxels, and each tile keeps the set
+ * of voxels its segments crossed; a tile is dirty when that set meets the
+ * voxels around where a changed sphere was or is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "animation.h"
+
+/* Longest line of a script */
+#define MAX_LINE 1024
+
+/* Where primary rays start, as in tracePrimaries */
+#define PRIMARY_Z -2000.0f
+
+/* Intersection tests round by up to about this much of the distance from
+ * the start of the ray, as in bvh.c */
+#define DISTANCE_SLACK 1e-3f
+
+/* Bits of voxel sets across every tile, and the most and fewest voxels
+ * the grid may have however many tiles there are */
+#define REACH_BITS (1 << 28)
+#define MAX_VOXELS (1 << 16)
+#define MIN_VOXELS 512
+
+/* Group keys by object, then order them by frame */
+static int compareKeys(const void *a, const void *b){
+	const keyframe *p = a, *q = b;
+	if(p->isLight != q->isLight)
+		return p->isLight - q->isLight;
+	if(p->index != q->index)
+		return p->index - q->index;
+	return p->frame - q->frame;
+}
+
+/* Whether the rest of a line holds nothing but a comment */
+static bool lineEnds(const char *p){
+	p += strspn(p, " \t\r");
+	return *p == '#' || *p == '\n' || *p == '\0';
+}
+
+bool loadAnimation(const char *filename, scene *sc, animation *a){
+	FILE *f = fopen(filename, "r");
+	if(f == NULL){
+		perror(filename);
+		return false;
+	}
+	char text[MAX_LINE];
+	int capacity = 0, line = 0;
+	bool ok = true;
+	memset(a, 0, sizeof(animation));
+	while(ok && fgets(text, sizeof(text), f) != NULL){
+		char keyword[16];
+		int used = 0;
+		line++;
+
+		char *p = text + strspn(text, " \t");
+		if(lineEnds(p))
+			continue;
+		if(sscanf(p, "%15s%n", keyword, &used) != 1)
+			continue;
+		p += used;
+		if(strcmp(keyword, "frames") == 0){
+			if(sscanf(p, "%d%n", &a->numFrames, &used) != 1 || !lineEnds(p + used) || a->numFrames < 1){
+				fprintf(stderr, "%s:%d: frames must be a positive count\n", filename, line);
+				ok = false;
+			}
+		}else if(strcmp(keyword, "sphere") == 0 || strcmp(keyword, "light") == 0){
+			keyframe k;
+			k.isLight = keyword[0] == 'l';
+			k.radius = 0;
+			if(k.isLight)
+				ok = sscanf(p, "%d %d %f %f %f%n", &k.frame, &k.index, &k.pos.x, &k.pos.y, &k.pos.z, &used) == 5;
+			else
+				ok = sscanf(p, "%d %d %f %f %f %f%n", &k.frame, &k.index, &k.pos.x, &k.pos.y, &k.pos.z, &k.radius, &used) == 6;
+			if(!ok || !lineEnds(p + used)){
+				fprintf(stderr, "%s:%d: expected a frame, an index and %d numbers\n", filename, line, k.isLight ? 3 : 4);
+				ok = false;
+			}else if(k.frame < 0 || k.index < 0 || k.index >= (k.isLight ? sc->numLights : sc->numSpheres)){
+				fprintf(stderr, "%s:%d: no %s %d at frame %d\n", filename, line, keyword, k.index, k.frame);
+				ok = false;
+			}else{
+				if(a->numKeys == capacity){
+					capacity = capacity ? 2 * capacity : 64;
+					a->keys = realloc(a->keys, capacity * sizeof(keyframe));
+				}
+				a->keys[a->numKeys++] = k;
+			}
+		}else{
+			fprintf(stderr, "%s:%d: unknown directive\n", filename, line);
+			ok = false;
+		}
+	}
+	fclose(f);
+
+	int i;
+	if(ok && a->numFrames == 0){
+		fprintf(stderr, "%s: no frames\n", filename);
+		ok = false;
+	}
+	qsort(a->keys, a->numKeys, sizeof(keyframe), compareKeys);
+	for(i = 1; ok && i < a->numKeys; i++){
+		if(compareKeys(&a->keys[i - 1], &a->keys[i]) == 0){
+			fprintf(stderr, "%s: %s %d has two keys at frame %d\n", filename,
+					a->keys[i].isLight ? "light" : "sphere", a->keys[i].index, a->keys[i].frame);
+			ok = false;
+		}
+	}
+	if(!ok)
+		freeAnimation(a);
+	return ok;
+}
+
+void freeAnimation(animation *a){
+	free(a->keys);
+	a->keys = NULL;
+	a->numKeys = 0;
+}
+
+void poseScene(animation *a, int frame, scene *sc){
+	int first, last;
+	for(first = 0; first < a->numKeys; first = last){
+		keyframe *k = &a->keys[first];
+		for(last = first + 1; last < a->numKeys && a->keys[last].isLight == k->isLight && a->keys[last].index == k->index; last++)
+			;
+
+		/* The keys either side of frame; exact and outside frames use one */
+		int next = first;
+		while(next < last && a->keys[next].frame < frame)
+			next++;
+		keyframe *from, *to;
+		if(next == last)
+			from = to = &a->keys[last - 1];
+		else if(next == first || a->keys[next].frame == frame)
+			from = to = &a->keys[next];
+		else{
+			from = &a->keys[next - 1];
+			to = &a->keys[next];
+		}
+		float blend = from == to ? 0 : (float)(frame - from->frame) / (to->frame - from->frame);
+		vector pos;
+		pos.x = from->pos.x + (to->pos.x - from->pos.x) * blend;
+		pos.y = from->pos.y + (to->pos.y - from->pos.y) * blend;
+		pos.z = from->pos.z + (to->pos.z - from->pos.z) * blend;
+		if(k->isLight)
+			sc->lights[k->index].pos = pos;
+		else{
+			sc->spheres[k->index].pos = pos;
+			sc->spheres[k->index].radius = from->radius + (to->radius - from->radius) * blend;
+		}
+	}
+}
+
+/* Grow b to hold a sphere at pos of the given radius */
+static void addSphere(box *b, vector *pos, float radius){
+	b->min[0] = fminf(b->min[0], pos->x - radius);
+	b->min[1] = fminf(b->min[1], pos->y - radius);
+	b->min[2] = fminf(b->min[2], pos->z - radius);
+	b->max[0] = fmaxf(b->max[0], pos->x + radius);
+	b->max[1] = fmaxf(b->max[1], pos->y + radius);
+	b->max[2] = fmaxf(b->max[2], pos->z + radius);
+}
+
+static void emptyBox(box *b){
+	int axis;
+	for(axis = 0; axis < 3; axis++){
+		b->min[axis] = INFINITY;
+		b->max[axis] = -INFINITY;
+	}
+}
+
+/* Voxels a grid of cubes of the given side would need */
+static double voxelsOfSide(float *extent, float side){
+	return fmax(1, ceil(extent[0] / side)) * fmax(1, ceil(extent[1] / side)) * fmax(1, ceil(extent[2] / side));
+}
+
+reachGrid animationReach(animation *a, scene *sc, int numTiles){
+	reachGrid g;
+	box *b = &g.bounds;
+	float extent[3];
+	int i, axis;
+
+	/* Interpolation stays between keys, so keys bound every frame */
+	emptyBox(b);
+	for(i = 0; i < sc->numSpheres; i++)
+		addSphere(b, &sc->spheres[i].pos, sc->spheres[i].radius);
+	for(i = 0; i < a->numKeys; i++)
+		if(!a->keys[i].isLight)
+			addSphere(b, &a->keys[i].pos, a->keys[i].radius);
+	if(b->min[0] > b->max[0]){
+		for(axis = 0; axis < 3; axis++){
+			g.dims[axis] = 1;
+			g.size[axis] = 1;
+		}
+		g.words = 1;
+		g.slack = 0;
+		return g;
+	}
+
+	/* A ray can come this far before reaching anything in the box;
+	 * pad by the rounding of the tests over that distance */
+	float size = b->max[0] - b->min[0] + b->max[1] - b->min[1] + b->max[2] - b->min[2];
+	g.slack = DISTANCE_SLACK * (size + fabsf(b->min[2] - PRIMARY_Z) + fabsf(b->max[2] - PRIMARY_Z)) + 1.0f;
+	for(axis = 0; axis < 3; axis++){
+		b->min[axis] -= g.slack;
+		b->max[axis] += g.slack;
+		extent[axis] = b->max[axis] - b->min[axis];
+	}
+
+	/* The smallest cubes whose voxels fit the budget */
+	double budget = fmin(MAX_VOXELS, fmax(MIN_VOXELS, (double) REACH_BITS / numTiles));
+	float low = 0, high = fmaxf(extent[0], fmaxf(extent[1], extent[2]));
+	for(i = 0; i < 40; i++){
+		float side = (low + high) / 2;
+		if(voxelsOfSide(extent, side) > budget)
+			low = side;
+		else
+			high = side;
+	}
+	for(axis = 0; axis < 3; axis++){
+		g.dims[axis] = (int) fmax(1, ceil(extent[axis] / high));
+		g.size[axis] = extent[axis] / g.dims[axis];
+	}
+	g.words = (g.dims[0] * g.dims[1] * g.dims[2] + 63) / 64;
+	return g;
+}
+
+tileReach *allocReach(reachGrid *g, int numTiles){
+	tileReach *reach = malloc(numTiles * sizeof(tileReach));
+	unsigned long long *voxels = calloc((size_t) numTiles * g->words, sizeof(unsigned long long));
+	int tile;
+	for(tile = 0; tile < numTiles; tile++){
+		reach[tile].voxels = voxels + (size_t) tile * g->words;
+		reach[tile].shaded = false;
+	}
+	return reach;
+}
+
+void freeReach(tileReach *reach){
+	free(reach[0].voxels);
+	free(reach);
+}
+
+void clearReach(reachGrid *g, tileReach *reach){
+	memset(reach->voxels, 0, g->words * sizeof(unsigned long long));
+	reach->shaded = false;
+}
+
+/* Set every voxel of the grid that overlaps the box from lo to hi */
+static void markVoxels(reachGrid *g, unsigned long long *voxels, float *lo, float *hi){
+	int first[3], last[3], axis, x, y, z;
+	for(axis = 0; axis < 3; axis++){
+		if(hi[axis] < g->bounds.min[axis] || lo[axis] > g->bounds.max[axis])
+			return;
+		first[axis] = (int) fmaxf(0, floorf((lo[axis] - g->bounds.min[axis]) / g->size[axis]));
+		last[axis] = (int) fminf(g->dims[axis] - 1, floorf((hi[axis] - g->bounds.min[axis]) / g->size[axis]));
+	}
+	for(z = first[2]; z <= last[2]; z++)
+		for(y = first[1]; y <= last[1]; y++)
+			for(x = first[0]; x <= last[0]; x++){
+				int voxel = (z * g->dims[1] + y) * g->dims[0] + x;
+				voxels[voxel / 64] |= 1ULL << (voxel % 64);
+			}
+}
+
+void addSegment(reachGrid *g, tileReach *reach, vector *start, vector *dir, float t, bool hit){
+	box *clip = &g->bounds;
+	float s[3] = {start->x, start->y, start->z};
+	float d[3] = {dir->x, dir->y, dir->z};
+	float near = 0, far = t;
+	int axis, piece;
+	if(hit)
+		reach->shaded = true;
+	if(clip->min[0] > clip->max[0])
+		return;
+	for(axis = 0; axis < 3; axis++){
+		if(d[axis] == 0){
+			if(s[axis] < clip->min[axis] || s[axis] > clip->max[axis])
+				return;
+			continue;
+		}
+		float t0 = (clip->min[axis] - s[axis]) / d[axis];
+		float t1 = (clip->max[axis] - s[axis]) / d[axis];
+		near = fmaxf(near, fminf(t0, t1));
+		far = fminf(far, fmaxf(t0, t1));
+	}
+	if(near > far)
+		return;
+
+	/* Pieces no longer than a voxel, each marking the voxels its box
+	 * overlaps, so a long diagonal marks a line rather than a slab */
+	float step = fminf(g->size[0], fminf(g->size[1], g->size[2]));
+	int pieces = (int) fmaxf(1, ceilf((far - near) / step));
+	for(piece = 0; piece < pieces; piece++){
+		float t0 = near + (far - near) * piece / pieces;
+		float t1 = piece == pieces - 1 ? far : near + (far - near) * (piece + 1) / pieces;
+		float lo[3], hi[3];
+		for(axis = 0; axis < 3; axis++){
+			float a = s[axis] + d[axis] * t0;
+			float b = s[axis] + d[axis] * t1;
+			lo[axis] = fminf(a, b);
+			hi[axis] = fmaxf(a, b);
+		}
+		markVoxels(g, reach->voxels, lo, hi);
+	}
+}
+
+int findDirtyTiles(reachGrid *g, tileReach *reach, int numTiles, sphere *before, light *lightsBefore, scene *sc, int *dirty){
+	bool lightsChanged = memcmp(lightsBefore, sc->lights, sc->numLights * sizeof(light)) != 0;
+	unsigned long long *changed = calloc(g->words, sizeof(unsigned long long));
+	int count = 0, tile, i;
+
+	/* Everywhere a changed sphere was or is, padded for rounding */
+	for(i = 0; i < sc->numSpheres; i++){
+		if(memcmp(&before[i], &sc->spheres[i], sizeof(sphere)) == 0)
+			continue;
+		box b;
+		emptyBox(&b);
+		addSphere(&b, &before[i].pos, before[i].radius + g->slack);
+		addSphere(&b, &sc->spheres[i].pos, sc->spheres[i].radius + g->slack);
+		markVoxels(g, changed, b.min, b.max);
+	}
+
+	bool *marked = malloc(numTiles * sizeof(bool));
+	#pragma omp parallel for schedule(dynamic, 64) private(i)
+	for(tile = 0; tile < numTiles; tile++){
+		marked[tile] = lightsChanged && reach[tile].shaded;
+		for(i = 0; i < g->words && !marked[tile]; i++)
+			marked[tile] = (reach[tile].voxels[i] & changed[i]) != 0;
+	}
+	for(tile = 0; tile < numTiles; tile++)
+		if(marked[tile])
+			dirty[count++] = tile;
+	free(marked);
+	free(changed);
+	return count;
+}
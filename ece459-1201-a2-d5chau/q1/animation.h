@@ -0,0 +1,80 @@
+/* Keyframed animation and the tiles each frame must re-render.
+ *
+ * A script moves spheres and lights of a scene through a sequence of
+ * frames. One directive per line; '#' starts a comment.
+ *
+ *   frames <count>
+ *   sphere <frame> <index> <x> <y> <z> <radius>
+ *   light <frame> <index> <x> <y> <z>
+ *
+ * An object is interpolated linearly between its keys and holds its first
+ * and last keys before and after them; objects without keys stay where the
+ * scene puts them.
+ */
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "scene.h"
+
+typedef struct{
+	float min[3], max[3];
+}box;
+
+/* Voxels over a box holding every sphere of an animation at every frame;
+ * rays outside it can hit nothing */
+typedef struct{
+	box bounds;
+	int dims[3];
+	float size[3];		/* Of one voxel */
+	int words;		/* 64-bit words in a set of voxels */
+	float slack;		/* Padding for rounding in the intersection tests */
+}reachGrid;
+
+typedef struct{
+	int frame;
+	int index;		/* Of the sphere or light */
+	bool isLight;
+	vector pos;
+	float radius;		/* Spheres only */
+}keyframe;
+
+typedef struct{
+	int numFrames;
+	keyframe *keys;		/* Grouped by object, in frame order within each */
+	int numKeys;
+}animation;
+
+/* Where the rays of one tile went last time it was rendered */
+typedef struct{
+	unsigned long long *voxels;	/* Bit set for each voxel a ray segment crossed */
+	bool shaded;			/* Some ray hit a sphere, so lights matter */
+}tileReach;
+
+/* Read a script for sc; prints the problem and returns false if it is
+ * malformed or names objects sc does not have */
+bool loadAnimation(const char *filename, scene *sc, animation *a);
+void freeAnimation(animation *a);
+
+/* Move sc's objects to where they are at frame */
+void poseScene(animation *a, int frame, scene *sc);
+
+/* The grid for sc as a moves it, sized for numTiles sets of voxels */
+reachGrid animationReach(animation *a, scene *sc, int numTiles);
+
+/* Sets of voxels for numTiles tiles, freed with freeReach */
+tileReach *allocReach(reachGrid *g, int numTiles);
+void freeReach(tileReach *reach);
+
+/* Forget a tile's rays before it is rendered */
+void clearReach(reachGrid *g, tileReach *reach);
+
+/* Record the segment from start to t along dir, and whether it hit */
+void addSegment(reachGrid *g, tileReach *reach, vector *start, vector *dir, float t, bool hit);
+
+/* List in dirty the tiles whose images can differ between the frame
+ * with spheres and lights before and the one sc now holds, given where
+ * their rays went in the former; returns how many */
+int findDirtyTiles(reachGrid *g, tileReach *reach, int numTiles, sphere *before, light *lightsBefore, scene *sc, int *dirty);
+
+#endif
@@ -0,0 +1,114 @@
+/* Ordered output of an image rendered in bands of rows */
+
+#include <stdlib.h>
+#include "bandwriter.h"
+
+static void *writeBands(void *arg){
+	bandWriter *w = arg;
+	int band;
+	for(band = 0; band < w->numBands; band++){
+		int slot = band % w->numSlots;
+		int rows = w->height - band * w->bandRows;
+		if(rows > w->bandRows)
+			rows = w->bandRows;
+
+		pthread_mutex_lock(&w->lock);
+		while(w->partsLeft[slot] > 0)
+			pthread_cond_wait(&w->changed, &w->lock);
+		pthread_mutex_unlock(&w->lock);
+
+		/* The slot is only touched here until it is released below */
+		if(w->encode != NULL){
+			if(w->encoded[slot] == NULL || (!w->failed && fwrite(w->encoded[slot], 1, w->encodedSize[slot], w->out) != w->encodedSize[slot]))
+				w->failed = true;
+			free(w->encoded[slot]);
+			w->encoded[slot] = NULL;
+		}else if(!w->failed && fwrite(w->slots + slot * w->bandBytes, 3 * (size_t) w->width, rows, w->out) != (size_t) rows)
+			w->failed = true;
+
+		pthread_mutex_lock(&w->lock);
+		w->partsLeft[slot] = w->partsPerBand;
+		w->written = band + 1;
+		pthread_cond_broadcast(&w->changed);
+		pthread_mutex_unlock(&w->lock);
+	}
+	return NULL;
+}
+
+bool startBandWriter(bandWriter *w, FILE *out, int width, int height, int bandRows, int partsPerBand, int numSlots, bandEncoder encode, void *encodeArg){
+	int i;
+	w->out = out;
+	w->width = width;
+	w->height = height;
+	w->bandRows = bandRows;
+	w->numBands = (height + bandRows - 1) / bandRows;
+	w->partsPerBand = partsPerBand;
+	w->numSlots = numSlots;
+	w->bandBytes = 3 * (size_t) width * bandRows;
+	w->slots = malloc(numSlots * w->bandBytes);
+	w->partsLeft = malloc(numSlots * sizeof(int));
+	w->encode = encode;
+	w->encodeArg = encodeArg;
+	w->encoded = calloc(numSlots, sizeof(unsigned char *));
+	w->encodedSize = calloc(numSlots, sizeof(size_t));
+	w->written = 0;
+	w->failed = false;
+	if(w->slots == NULL || w->partsLeft == NULL || w->encoded == NULL || w->encodedSize == NULL){
+		free(w->slots);
+		free(w->partsLeft);
+		free(w->encoded);
+		free(w->encodedSize);
+		return false;
+	}
+	for(i = 0; i < numSlots; i++)
+		w->partsLeft[i] = partsPerBand;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->changed, NULL);
+	if(pthread_create(&w->thread, NULL, writeBands, w) != 0){
+		free(w->slots);
+		free(w->partsLeft);
+		free(w->encoded);
+		free(w->encodedSize);
+		return false;
+	}
+	return true;
+}
+
+unsigned char *acquireBand(bandWriter *w, int band){
+	pthread_mutex_lock(&w->lock);
+	while(band >= w->written + w->numSlots)
+		pthread_cond_wait(&w->changed, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+	return w->slots + (band % w->numSlots) * w->bandBytes;
+}
+
+void finishBandPart(bandWriter *w, int band){
+	int slot = band % w->numSlots;
+	pthread_mutex_lock(&w->lock);
+	if(w->encode == NULL || w->partsLeft[slot] > 1){
+		if(--w->partsLeft[slot] == 0)
+			pthread_cond_broadcast(&w->changed);
+		pthread_mutex_unlock(&w->lock);
+		return;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	/* The last part: nothing else touches the slot until the count
+	 * reaches zero, so encode it outside the lock */
+	w->encoded[slot] = w->encode(w->encodeArg, band, w->slots + slot * w->bandBytes, &w->encodedSize[slot]);
+	pthread_mutex_lock(&w->lock);
+	w->partsLeft[slot] = 0;
+	pthread_cond_broadcast(&w->changed);
+	pthread_mutex_unlock(&w->lock);
+}
+
+bool stopBandWriter(bandWriter *w){
+	pthread_join(w->thread, NULL);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->changed);
+	free(w->slots);
+	free(w->partsLeft);
+	free(w->encoded);
+	free(w->encodedSize);
+	return !w->failed;
+}
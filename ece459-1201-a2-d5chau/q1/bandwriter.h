@@ -0,0 +1,57 @@
+/* Ordered output of an image rendered in bands of rows.
+ *
+ * Renderers fill bands in a ring of slots and a writer thread writes each
+ * band to the file as soon as it is complete, in order, so only the ring
+ * is ever held in memory. An encoder, if given, is run on each band by
+ * the thread that completes it, so bands are encoded in parallel.
+ */
+
+#ifndef BANDWRITER_H
+#define BANDWRITER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* The bytes written for a complete band of rows, in a buffer the writer
+ * frees, with their length in *size; NULL if the band cannot be encoded */
+typedef unsigned char *(*bandEncoder)(void *arg, int band, unsigned char *rows, size_t *size);
+
+typedef struct{
+	FILE *out;
+	int width, height;
+	int bandRows;		/* Rows per band; the last band may be shorter */
+	int numBands;
+	int partsPerBand;	/* finishBandPart calls that complete a band */
+	int numSlots;
+	size_t bandBytes;
+	unsigned char *slots;	/* numSlots bands of bandBytes */
+	int *partsLeft;		/* Per slot, for the band it currently holds */
+	bandEncoder encode;	/* NULL to write rows as they are */
+	void *encodeArg;
+	unsigned char **encoded;	/* Per slot, what encode made of its band */
+	size_t *encodedSize;
+	int written;		/* Bands written so far */
+	bool failed;		/* A write failed; the rest are dropped */
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_t thread;
+}bandWriter;
+
+/* Start writing width by height RGB pixels to out, which already holds
+ * any header, through encode unless it is NULL; false if it could not be
+ * started */
+bool startBandWriter(bandWriter *w, FILE *out, int width, int height, int bandRows, int partsPerBand, int numSlots, bandEncoder encode, void *encodeArg);
+
+/* The slot band is rendered into, waiting while the ring is full. Bands
+ * must be acquired in roughly increasing order: a thread blocked on band b
+ * relies on the parts of band b - numSlots being rendered by others */
+unsigned char *acquireBand(bandWriter *w, int band);
+
+/* One part of a band is rendered; the last one hands it to the writer */
+void finishBandPart(bandWriter *w, int band);
+
+/* Wait for every band to be written; false if any write failed */
+bool stopBandWriter(bandWriter *w);
+
+#endif
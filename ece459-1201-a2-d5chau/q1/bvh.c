@@ -0,0 +1,386 @@
+/* Bounding volume hierarchy over a scene's spheres.
+ *
+ * The tree is built top down with the surface area heuristic evaluated over
+ * a fixed number of centroid bins, so each level costs one pass over its
+ * spheres. Subtrees above PARALLEL_SPHERES are handed to OpenMP tasks; each
+ * task only reorders its own range of the sphere order, so no locking is
+ * needed. The finished tree is copied depth first into one array, which
+ * puts every first child next to its parent.
+ *
+ * Traversal must find exactly the sphere a linear scan would. Hits are
+ * taken with intersectRaySphereIndexed, whose tie break makes the answer
+ * independent of visiting order. Boxes are padded for rounding twice: once
+ * when built, for the coordinates, and again in the slab test for the
+ * distance from the ray's start, because intersectRaySphere's discriminant
+ * is off by up to about 5e-7 L^2 for a sphere L away. That admits rays as
+ * much as 7e-4 L outside the sphere, and the linear scan counts them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "bvh.h"
+
+/* Centroid bins the SAH is evaluated over */
+#define SAH_BINS 16
+
+/* Leaves hold at most this many spheres unless the tree gets too deep */
+#define MAX_LEAF 4
+
+/* Subtrees with more spheres than this are built as separate tasks */
+#define PARALLEL_SPHERES 4096
+
+/* Below MEDIAN_DEPTH subtrees are halved rather than split by the SAH, so
+ * a skewed scene cannot outgrow the traversal stacks before MAX_DEPTH */
+#define MEDIAN_DEPTH 36
+#define MAX_DEPTH 60
+
+/* Boxes grow by this much per unit of distance from the ray's start */
+#define DISTANCE_SLACK 1e-3f
+
+typedef struct{
+	float min[3], max[3];
+}box;
+
+typedef struct buildNode{
+	box bounds;
+	int first, count, axis;
+	struct buildNode *child[2];
+}buildNode;
+
+/* Shared by every build task; each reorders only its own range of order */
+typedef struct{
+	box *boxes;		/* Padded box of each scene sphere */
+	float *centroids;	/* Three per scene sphere */
+	int *order;		/* Scene indices, reordered into leaf order */
+	int numNodes;
+}buildState;
+
+static void boxEmpty(box *b){
+	int a;
+	for(a = 0; a < 3; a++){
+		b->min[a] = FLT_MAX;
+		b->max[a] = -FLT_MAX;
+	}
+}
+
+static void boxGrow(box *b, box *other){
+	int a;
+	for(a = 0; a < 3; a++){
+		if(other->min[a] < b->min[a])
+			b->min[a] = other->min[a];
+		if(other->max[a] > b->max[a])
+			b->max[a] = other->max[a];
+	}
+}
+
+/* Half the surface area, which is all the SAH needs */
+static float boxArea(box *b){
+	float dx = b->max[0] - b->min[0];
+	float dy = b->max[1] - b->min[1];
+	float dz = b->max[2] - b->min[2];
+	if(dx < 0)
+		return 0;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+/* The sphere's box, grown by a margin well above the rounding of its own
+ * coordinates; the slab test adds the allowance for distance */
+static box sphereBox(sphere *s){
+	float c[3] = {s->pos.x, s->pos.y, s->pos.z};
+	float largest = fmaxf(fabsf(c[0]), fmaxf(fabsf(c[1]), fabsf(c[2])));
+	float extent = s->radius * 1.001f + largest * 1e-4f + 1e-2f;
+	box b;
+	int a;
+	for(a = 0; a < 3; a++){
+		b.min[a] = c[a] - extent;
+		b.max[a] = c[a] + extent;
+	}
+	return b;
+}
+
+static buildNode *makeLeaf(buildNode *node, int first, int count){
+	node->first = first;
+	node->count = count;
+	node->child[0] = node->child[1] = NULL;
+	return node;
+}
+
+/* Build the subtree over order[first .. first + count - 1] */
+static buildNode *buildRecursive(buildState *b, int first, int count, int depth){
+	buildNode *node = malloc(sizeof(buildNode));
+	box centroidBounds;
+	int i, a;
+
+	#pragma omp atomic
+	b->numNodes++;
+
+	boxEmpty(&node->bounds);
+	boxEmpty(&centroidBounds);
+	for(i = first; i < first + count; i++){
+		int s = b->order[i];
+		box c;
+		boxGrow(&node->bounds, &b->boxes[s]);
+		for(a = 0; a < 3; a++)
+			c.min[a] = c.max[a] = b->centroids[3*s + a];
+		boxGrow(&centroidBounds, &c);
+	}
+	if(count <= 1 || depth >= MAX_DEPTH)
+		return makeLeaf(node, first, count);
+
+	/* Bin along the axis the centroids spread furthest on */
+	int axis = 0;
+	for(a = 1; a < 3; a++){
+		if(centroidBounds.max[a] - centroidBounds.min[a] > centroidBounds.max[axis] - centroidBounds.min[axis])
+			axis = a;
+	}
+	float lo = centroidBounds.min[axis];
+	float extent = centroidBounds.max[axis] - lo;
+	node->axis = axis;
+
+	int split = first + count / 2;
+	if(extent > 0 && depth < MEDIAN_DEPTH){
+		box binBounds[SAH_BINS];
+		int binCount[SAH_BINS];
+		float scale = SAH_BINS / extent;
+		for(i = 0; i < SAH_BINS; i++){
+			boxEmpty(&binBounds[i]);
+			binCount[i] = 0;
+		}
+		for(i = first; i < first + count; i++){
+			int s = b->order[i];
+			int bin = (int)((b->centroids[3*s + axis] - lo) * scale);
+			if(bin >= SAH_BINS)
+				bin = SAH_BINS - 1;
+			binCount[bin]++;
+			boxGrow(&binBounds[bin], &b->boxes[s]);
+		}
+
+		/* Cost of splitting after each bin: sweep from the right, then
+		 * from the left */
+		float rightCost[SAH_BINS];
+		box sweep;
+		int n = 0;
+		boxEmpty(&sweep);
+		for(i = SAH_BINS - 1; i > 0; i--){
+			boxGrow(&sweep, &binBounds[i]);
+			n += binCount[i];
+			rightCost[i - 1] = n * boxArea(&sweep);
+		}
+		int bestBin = -1;
+		float bestCost = FLT_MAX;
+		n = 0;
+		boxEmpty(&sweep);
+		for(i = 0; i < SAH_BINS - 1; i++){
+			boxGrow(&sweep, &binBounds[i]);
+			n += binCount[i];
+			float cost = n * boxArea(&sweep) + rightCost[i];
+			if(n > 0 && n < count && cost < bestCost){
+				bestCost = cost;
+				bestBin = i;
+			}
+		}
+
+		/* A leaf is cheaper than any split */
+		if(count <= MAX_LEAF && (bestBin < 0 || bestCost >= count * boxArea(&node->bounds)))
+			return makeLeaf(node, first, count);
+
+		if(bestBin >= 0){
+			int left = first, right = first + count - 1;
+			while(left <= right){
+				int s = b->order[left];
+				int bin = (int)((b->centroids[3*s + axis] - lo) * scale);
+				if(bin >= SAH_BINS)
+					bin = SAH_BINS - 1;
+				if(bin <= bestBin)
+					left++;
+				else{
+					b->order[left] = b->order[right];
+					b->order[right--] = s;
+				}
+			}
+			split = left;
+		}
+	}else if(count <= MAX_LEAF)
+		return makeLeaf(node, first, count);
+
+	/* Coincident centroids and deep subtrees fall through to a median
+	 * split by position in the order, which still halves the work */
+	node->first = first;
+	node->count = 0;
+	if(count > PARALLEL_SPHERES){
+		#pragma omp task shared(node) firstprivate(b, first, split, depth)
+		node->child[0] = buildRecursive(b, first, split - first, depth + 1);
+		node->child[1] = buildRecursive(b, split, first + count - split, depth + 1);
+		#pragma omp taskwait
+	}else{
+		node->child[0] = buildRecursive(b, first, split - first, depth + 1);
+		node->child[1] = buildRecursive(b, split, first + count - split, depth + 1);
+	}
+	return node;
+}
+
+/* Copy the subtree depth first from position next; returns the position
+ * after it */
+static int flatten(bvhNode *nodes, buildNode *node, int next){
+	int position = next++;
+	bvhNode *out = &nodes[position];
+	memcpy(out->min, node->bounds.min, sizeof(out->min));
+	memcpy(out->max, node->bounds.max, sizeof(out->max));
+	out->axis = 0;
+	if(node->count > 0 || node->child[0] == NULL){
+		out->offset = node->first;
+		out->count = node->count;
+	}else{
+		out->count = 0;
+		out->axis = node->axis;
+		next = flatten(nodes, node->child[0], next);
+		out->offset = next;
+		next = flatten(nodes, node->child[1], next);
+	}
+	free(node);
+	return next;
+}
+
+bvh buildBVH(sphere *spheres, int count){
+	buildState state;
+	bvh b;
+	int i;
+
+	state.boxes = malloc(count * sizeof(box));
+	state.centroids = malloc(3 * count * sizeof(float));
+	state.order = malloc(count * sizeof(int));
+	state.numNodes = 0;
+	#pragma omp parallel for
+	for(i = 0; i < count; i++){
+		state.boxes[i] = sphereBox(&spheres[i]);
+		state.centroids[3*i + 0] = spheres[i].pos.x;
+		state.centroids[3*i + 1] = spheres[i].pos.y;
+		state.centroids[3*i + 2] = spheres[i].pos.z;
+		state.order[i] = i;
+	}
+
+	buildNode *root = NULL;
+	#pragma omp parallel
+	#pragma omp single
+	root = buildRecursive(&state, 0, count, 0);
+
+	b.nodes = malloc(state.numNodes * sizeof(bvhNode));
+	b.numNodes = flatten(b.nodes, root, 0);
+
+	/* Leaves index straight into the spheres in leaf order */
+	b.spheres = malloc(count * sizeof(sphere));
+	for(i = 0; i < count; i++)
+		b.spheres[i] = spheres[state.order[i]];
+	b.soa = makeSphereArrays(b.spheres, count);
+	for(i = 0; i < count; i++)
+		b.soa.index[i] = state.order[i];
+	b.index = b.soa.index;
+
+	free(state.boxes);
+	free(state.centroids);
+	free(state.order);
+	return b;
+}
+
+void freeBVH(bvh *b){
+	free(b->nodes);
+	free(b->spheres);
+	freeSphereArrays(&b->soa);
+}
+
+/* Whether the ray enters the box before far, once the box is grown by the
+ * rounding allowance for the farthest sphere it could hold. fminf and
+ * fmaxf ignore the NaN of 0 * inf, so an axis the ray is parallel to never
+ * rejects */
+static inline bool rayHitsBox(bvhNode *node, float *start, float *inverse, float far){
+	float reach = 0;
+	float near = 0;
+	int a;
+
+	/* The L1 distance to the farthest corner bounds the distance to
+	 * anything inside */
+	for(a = 0; a < 3; a++)
+		reach += fmaxf(fabsf(start[a] - node->min[a]), fabsf(start[a] - node->max[a]));
+	float pad = DISTANCE_SLACK * reach;
+	for(a = 0; a < 3; a++){
+		float t0 = (node->min[a] - pad - start[a]) * inverse[a];
+		float t1 = (node->max[a] + pad - start[a]) * inverse[a];
+		near = fmaxf(near, fminf(t0, t1));
+		far = fminf(far, fmaxf(t0, t1));
+	}
+	return near <= far;
+}
+
+int intersectBVH(bvh *b, ray *r, float *t, int *hit){
+	float start[3] = {r->start.x, r->start.y, r->start.z};
+	float dir[3] = {r->dir.x, r->dir.y, r->dir.z};
+	float inverse[3] = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+	int stack[MAX_DEPTH + 4];
+	int depth = 0;
+	int tests = 0;
+	int i;
+
+	if(b->soa.count == 0)
+		return 0;
+	stack[depth++] = 0;
+	while(depth > 0){
+		bvhNode *node = &b->nodes[stack[--depth]];
+		if(!rayHitsBox(node, start, inverse, *t))
+			continue;
+		if(node->count > 0){
+			for(i = node->offset; i < node->offset + node->count; i++)
+				intersectRaySphereIndexed(r, &b->spheres[i], b->index[i], t, hit);
+			tests += node->count;
+		}else{
+			int first = node - b->nodes + 1;
+			if(dir[node->axis] < 0){
+				stack[depth++] = first;
+				stack[depth++] = node->offset;
+			}else{
+				stack[depth++] = node->offset;
+				stack[depth++] = first;
+			}
+		}
+	}
+	return tests;
+}
+
+int intersectPacketBVH(packetKernel kernel, bvh *b, rayPacket *p){
+	float dir[3] = {p->dir.x, p->dir.y, p->dir.z};
+	float inverse[3] = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+	int stack[MAX_DEPTH + 4];
+	int depth = 0;
+	int tests = 0;
+	int k;
+
+	if(b->soa.count == 0)
+		return 0;
+	stack[depth++] = 0;
+	while(depth > 0){
+		bvhNode *node = &b->nodes[stack[--depth]];
+
+		/* Visit the node if any ray in the packet reaches it */
+		for(k = 0; k < p->count; k++){
+			float start[3] = {p->startX[k], p->startY[k], p->startZ[k]};
+			if(rayHitsBox(node, start, inverse, p->t[k]))
+				break;
+		}
+		if(k == p->count)
+			continue;
+		if(node->count > 0){
+			intersectPacketRange(kernel, &b->soa, node->offset, node->count, p);
+			tests += node->count * p->count;
+		}else{
+			int first = node - b->nodes + 1;
+			if(dir[node->axis] < 0){
+				stack[depth++] = first;
+				stack[depth++] = node->offset;
+			}else{
+				stack[depth++] = node->offset;
+				stack[depth++] = first;
+			}
+		}
+	}
+	return tests;
+}
@@ -0,0 +1,40 @@
+/* Bounding volume hierarchy over a scene's spheres */
+
+#ifndef BVH_H
+#define BVH_H
+
+#include "raytrace.h"
+#include "packet.h"
+
+/* A node of the flattened tree. An interior node's first child follows it
+ * directly and its second child is at offset; a leaf's spheres are
+ * offset to offset + count - 1 in leaf order. 32 bytes, two to a line. */
+typedef struct{
+	float min[3], max[3];
+	int offset;
+	short count;	/* Spheres in a leaf, 0 for an interior node */
+	short axis;	/* Split axis, so the nearer child is visited first */
+}bvhNode;
+
+typedef struct{
+	bvhNode *nodes;
+	int numNodes;
+	sphere *spheres;	/* The scene's spheres in leaf order */
+	sphereArrays soa;	/* The same in structure-of-arrays form */
+	int *index;		/* Index in the scene of each sphere in leaf order */
+}bvh;
+
+/* Build with binned SAH, splitting large subtrees in parallel with OpenMP
+ * tasks; call from outside a parallel region */
+bvh buildBVH(sphere *spheres, int count);
+void freeBVH(bvh *b);
+
+/* Closest hit along r, updating t and hit as intersectRaySphereIndexed
+ * would after testing every sphere; returns the spheres actually tested */
+int intersectBVH(bvh *b, ray *r, float *t, int *hit);
+
+/* The same for every ray in a packet, testing leaves with the kernel;
+ * returns the ray-sphere tests, counting every ray of the packet */
+int intersectPacketBVH(packetKernel kernel, bvh *b, rayPacket *p);
+
+#endif
@@ -0,0 +1,478 @@
+/* Tiles rendered by worker processes on this host or others.
+ *
+ * Messages are runs of ints in the machine's own layout:
+ *
+ *   worker hello       WORKER_MAGIC, threads
+ *   scene              SCENE_MAGIC, tile size, width, height, depth, then
+ *                      the counts and arrays of materials, spheres, lights
+ *   batch              count, then count tile numbers
+ *   tile               tile number, then its pixels row after row
+ *
+ * The coordinator is one thread polling every worker. Each worker holds a
+ * window of tiles, refilled when half of it has come back, so it always
+ * has the next ones queued while it renders.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "distrib.h"
+
+#define WORKER_MAGIC 0x5254574b
+#define SCENE_MAGIC 0x52545343
+
+/* Tiles a worker holds per thread it renders with */
+#define TILES_PER_THREAD 2
+
+/* Seconds a worker keeps trying to reach a coordinator that is not up */
+#define CONNECT_SECONDS 10
+
+/* A tile is given to a second worker once it has been out this many times
+ * longer than tiles usually take to come back */
+#define BACKUP_FACTOR 2
+
+enum{TILE_QUEUED, TILE_RUNNING, TILE_DONE};
+
+typedef struct{
+	int fd;
+	int *tiles;		/* Sent and not yet back, oldest first */
+	int numTiles;
+	int window;		/* Most tiles it may hold */
+	double heard;		/* When it last sent a tile, or was sent some while idle */
+}tileWorker;
+
+typedef struct{
+	scene *sc;
+	int tileSize, tilesX, numTiles;
+	char *state;		/* TILE_QUEUED, TILE_RUNNING or TILE_DONE */
+	int *holders;		/* Workers holding each tile */
+	bool *backedUp;		/* Given to a second worker since it was last queued */
+	double *issued;		/* When each tile was last taken from the queue */
+	int *queue;		/* Ring of queued tiles */
+	int head, queued;
+	int done;
+	double turnaround;	/* Total time done tiles were out */
+	tileWorker *workers;
+	int numWorkers, workerCapacity;
+	unsigned char *img;
+	unsigned char *pixels;	/* One tile as it arrives */
+}coordinator;
+
+static double now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static bool sendAll(int fd, const void *data, size_t size){
+	const char *p = data;
+	while(size > 0){
+		ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent <= 0)
+			return false;
+		p += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool receiveAll(int fd, void *data, size_t size){
+	char *p = data;
+	while(size > 0){
+		ssize_t got = recv(fd, p, size, 0);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0)
+			return false;
+		p += got;
+		size -= got;
+	}
+	return true;
+}
+
+/* A socket bound to address and listening, or connected to it. Errors
+ * are printed, except for a connection found refused or missing while
+ * waiting, which is left in errno for the caller to try again */
+static int openSocket(const char *address, bool listening, bool waiting){
+	int fd = -1, saved;
+	if(strncmp(address, "unix:", 5) == 0){
+		struct sockaddr_un sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		if(strlen(address + 5) >= sizeof(sa.sun_path)){
+			fprintf(stderr, "%s: path too long\n", address);
+			return -1;
+		}
+		strcpy(sa.sun_path, address + 5);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd >= 0 && listening){
+			unlink(sa.sun_path);
+			if(bind(fd, (struct sockaddr *) &sa, sizeof(sa)) == 0 && listen(fd, SOMAXCONN) == 0)
+				return fd;
+		}else if(fd >= 0 && connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == 0)
+			return fd;
+	}else{
+		const char *colon = strrchr(address, ':');
+		char host[256];
+		struct addrinfo hints, *list, *a;
+		if(colon == NULL || colon - address >= (int) sizeof(host)){
+			fprintf(stderr, "%s: expected unix:<path> or <host>:<port>\n", address);
+			return -1;
+		}
+		memcpy(host, address, colon - address);
+		host[colon - address] = '\0';
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = listening ? AI_PASSIVE : 0;
+		int err = getaddrinfo(host[0] != '\0' ? host : NULL, colon + 1, &hints, &list);
+		if(err != 0){
+			fprintf(stderr, "%s: %s\n", address, gai_strerror(err));
+			return -1;
+		}
+		errno = ENOENT;
+		for(a = list; a != NULL; a = a->ai_next){
+			int on = 1;
+			fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if(fd < 0)
+				continue;
+			if(listening){
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+				if(bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0)
+					break;
+			}else if(connect(fd, a->ai_addr, a->ai_addrlen) == 0){
+				/* Batches are small and wanted at once */
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+				break;
+			}
+			saved = errno;
+			close(fd);
+			errno = saved;
+			fd = -1;
+		}
+		saved = errno;
+		freeaddrinfo(list);
+		errno = saved;
+		if(fd >= 0)
+			return fd;
+	}
+	saved = errno;
+	if(fd >= 0)
+		close(fd);
+	errno = saved;
+	if(!waiting || (errno != ECONNREFUSED && errno != ENOENT))
+		perror(address);
+	return -1;
+}
+
+int listenAt(const char *address){
+	return openSocket(address, true, false);
+}
+
+int connectTo(const char *address, int threads){
+	double deadline = now() + CONNECT_SECONDS;
+	int fd;
+	while((fd = openSocket(address, false, true)) < 0){
+		if(errno != ECONNREFUSED && errno != ENOENT)
+			return -1;
+		if(now() > deadline){
+			perror(address);
+			return -1;
+		}
+		usleep(100000);
+	}
+	int hello[2] = {WORKER_MAGIC, threads};
+	if(!sendAll(fd, hello, sizeof(hello))){
+		perror(address);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool sendScene(int fd, scene *sc, int tileSize){
+	int header[8] = {SCENE_MAGIC, tileSize, sc->width, sc->height, sc->maxDepth, sc->numMaterials, sc->numSpheres, sc->numLights};
+	return sendAll(fd, header, sizeof(header))
+			&& sendAll(fd, sc->materials, sc->numMaterials * sizeof(material))
+			&& sendAll(fd, sc->spheres, sc->numSpheres * sizeof(sphere))
+			&& sendAll(fd, sc->lights, sc->numLights * sizeof(light));
+}
+
+bool receiveScene(int fd, scene *sc, int tileSize){
+	int header[8];
+	memset(sc, 0, sizeof(scene));
+	if(!receiveAll(fd, header, sizeof(header)) || header[0] != SCENE_MAGIC
+			|| header[2] <= 0 || header[3] <= 0 || header[5] < 0 || header[6] < 0 || header[7] < 0){
+		fprintf(stderr, "No scene from the coordinator\n");
+		return false;
+	}
+	if(header[1] != tileSize){
+		fprintf(stderr, "The coordinator uses tiles of %d pixels, not %d\n", header[1], tileSize);
+		return false;
+	}
+	sc->width = header[2];
+	sc->height = header[3];
+	sc->maxDepth = header[4];
+	sc->numMaterials = header[5];
+	sc->numSpheres = header[6];
+	sc->numLights = header[7];
+	sc->materials = malloc(sc->numMaterials * sizeof(material));
+	sc->spheres = malloc(sc->numSpheres * sizeof(sphere));
+	sc->lights = malloc(sc->numLights * sizeof(light));
+	if(!receiveAll(fd, sc->materials, sc->numMaterials * sizeof(material))
+			|| !receiveAll(fd, sc->spheres, sc->numSpheres * sizeof(sphere))
+			|| !receiveAll(fd, sc->lights, sc->numLights * sizeof(light))){
+		fprintf(stderr, "Lost the coordinator while receiving the scene\n");
+		freeScene(sc);
+		return false;
+	}
+	return true;
+}
+
+bool receiveBatch(int fd, int *tiles, int maxTiles, int *count){
+	char first;
+	ssize_t got;
+	*count = 0;
+	do
+		got = recv(fd, &first, 1, MSG_PEEK);
+	while(got < 0 && errno == EINTR);
+	if(got == 0)
+		return true;
+	if(!receiveAll(fd, count, sizeof(int)) || *count < 0 || *count > maxTiles || !receiveAll(fd, tiles, *count * sizeof(int))){
+		*count = 0;
+		return false;
+	}
+	return true;
+}
+
+bool sendTile(int fd, int tile, unsigned char *pixels, int w, int h){
+	return sendAll(fd, &tile, sizeof(int)) && sendAll(fd, pixels, 3 * (size_t) w * h);
+}
+
+/* Where tile lies in the image */
+static void tileRect(coordinator *c, int tile, int *x0, int *y0, int *w, int *h){
+	*x0 = (tile % c->tilesX) * c->tileSize;
+	*y0 = (tile / c->tilesX) * c->tileSize;
+	*w = c->sc->width - *x0 < c->tileSize ? c->sc->width - *x0 : c->tileSize;
+	*h = c->sc->height - *y0 < c->tileSize ? c->sc->height - *y0 : c->tileSize;
+}
+
+static void queueTile(coordinator *c, int tile){
+	c->state[tile] = TILE_QUEUED;
+	c->backedUp[tile] = false;
+	c->queue[(c->head + c->queued) % c->numTiles] = tile;
+	c->queued++;
+}
+
+/* The tile out longest that w does not hold, if it is out for long
+ * enough and has no second worker yet; -1 if none is */
+static int backupFor(coordinator *c, tileWorker *w){
+	int best = -1, tile, i;
+	if(c->done == 0)
+		return -1;
+	double late = now() - BACKUP_FACTOR * c->turnaround / c->done;
+	for(tile = 0; tile < c->numTiles; tile++){
+		if(c->state[tile] != TILE_RUNNING || c->backedUp[tile] || c->issued[tile] > late)
+			continue;
+		if(best >= 0 && c->issued[tile] >= c->issued[best])
+			continue;
+		for(i = 0; i < w->numTiles && w->tiles[i] != tile; i++)
+			;
+		if(i == w->numTiles)
+			best = tile;
+	}
+	return best;
+}
+
+/* Once half of w's window is back, send it tiles to fill the window:
+ * queued ones, or second copies of late ones when the queue is empty */
+static bool fillWindow(coordinator *c, tileWorker *w){
+	int first = w->numTiles, tile;
+	if(w->numTiles > w->window / 2)
+		return true;
+	while(w->numTiles < w->window){
+		if(c->queued > 0){
+			tile = c->queue[c->head];
+			c->head = (c->head + 1) % c->numTiles;
+			c->queued--;
+			c->issued[tile] = now();
+		}else if((tile = backupFor(c, w)) >= 0)
+			c->backedUp[tile] = true;
+		else
+			break;
+		c->state[tile] = TILE_RUNNING;
+		c->holders[tile]++;
+		w->tiles[w->numTiles++] = tile;
+	}
+	int count = w->numTiles - first;
+	if(count == 0)
+		return true;
+	if(first == 0)
+		w->heard = now();
+	return sendAll(w->fd, &count, sizeof(int)) && sendAll(w->fd, w->tiles + first, count * sizeof(int));
+}
+
+/* Read one tile from w into the image, unless another worker was first */
+static bool receiveTile(coordinator *c, tileWorker *w){
+	int tile, i, x0, y0, tw, th, y;
+	if(!receiveAll(w->fd, &tile, sizeof(int)))
+		return false;
+	for(i = 0; i < w->numTiles && w->tiles[i] != tile; i++)
+		;
+	if(i == w->numTiles)
+		return false;
+	tileRect(c, tile, &x0, &y0, &tw, &th);
+	if(!receiveAll(w->fd, c->pixels, 3 * (size_t) tw * th))
+		return false;
+
+	memmove(&w->tiles[i], &w->tiles[i + 1], (w->numTiles - i - 1) * sizeof(int));
+	w->numTiles--;
+	w->heard = now();
+	c->holders[tile]--;
+	if(c->state[tile] == TILE_DONE)
+		return true;
+	for(y = 0; y < th; y++)
+		memcpy(c->img + ((size_t)(y0 + y) * c->sc->width + x0) * 3, c->pixels + (size_t) y * tw * 3, tw * 3);
+	c->state[tile] = TILE_DONE;
+	c->done++;
+	c->turnaround += w->heard - c->issued[tile];
+	return true;
+}
+
+/* Close worker index, queueing again whatever only it held */
+static void dropWorker(coordinator *c, int index, const char *why){
+	tileWorker *w = &c->workers[index];
+	int i, queued = 0;
+	for(i = 0; i < w->numTiles; i++){
+		int tile = w->tiles[i];
+		if(--c->holders[tile] == 0 && c->state[tile] != TILE_DONE){
+			queueTile(c, tile);
+			queued++;
+		}
+	}
+	fprintf(stderr, "A worker %s; %d tiles queued again\n", why, queued);
+	close(w->fd);
+	free(w->tiles);
+	c->workers[index] = c->workers[--c->numWorkers];
+}
+
+/* Accept a worker and send it the scene */
+static void addWorker(coordinator *c, int listener, double timeout){
+	int fd = accept(listener, NULL, NULL);
+	int hello[2], on = 1;
+	if(fd < 0)
+		return;
+
+	/* A worker that stops mid-message must not stall the others for good */
+	struct timeval limit;
+	limit.tv_sec = (time_t) timeout;
+	limit.tv_usec = (suseconds_t)((timeout - limit.tv_sec) * 1e6);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	if(!receiveAll(fd, hello, sizeof(hello)) || hello[0] != WORKER_MAGIC || hello[1] < 1 || !sendScene(fd, c->sc, c->tileSize)){
+		fprintf(stderr, "A worker failed to start\n");
+		close(fd);
+		return;
+	}
+
+	if(c->numWorkers == c->workerCapacity){
+		c->workerCapacity = c->workerCapacity ? 2 * c->workerCapacity : 16;
+		c->workers = realloc(c->workers, c->workerCapacity * sizeof(tileWorker));
+	}
+	tileWorker *w = &c->workers[c->numWorkers++];
+	w->fd = fd;
+	w->window = hello[1] * TILES_PER_THREAD < MAX_BATCH ? hello[1] * TILES_PER_THREAD : MAX_BATCH;
+	w->tiles = malloc(w->window * sizeof(int));
+	w->numTiles = 0;
+	w->heard = now();
+}
+
+bool coordinateTiles(int listener, scene *sc, int tileSize, double timeout, unsigned char *img){
+	coordinator c;
+	struct pollfd *fds = NULL;
+	int i, tile;
+	bool ok = true;
+
+	memset(&c, 0, sizeof(c));
+	c.sc = sc;
+	c.tileSize = tileSize;
+	c.tilesX = (sc->width + tileSize - 1) / tileSize;
+	c.numTiles = c.tilesX * ((sc->height + tileSize - 1) / tileSize);
+	c.state = malloc(c.numTiles);
+	c.holders = calloc(c.numTiles, sizeof(int));
+	c.backedUp = malloc(c.numTiles * sizeof(bool));
+	c.issued = malloc(c.numTiles * sizeof(double));
+	c.queue = malloc(c.numTiles * sizeof(int));
+	c.img = img;
+	c.pixels = malloc(3 * (size_t) tileSize * tileSize);
+	for(tile = 0; tile < c.numTiles; tile++)
+		queueTile(&c, tile);
+
+	while(c.done < c.numTiles){
+		for(i = c.numWorkers - 1; i >= 0; i--)
+			if(!fillWindow(&c, &c.workers[i]))
+				dropWorker(&c, i, "could not be sent tiles");
+
+		fds = realloc(fds, (c.numWorkers + 1) * sizeof(struct pollfd));
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for(i = 0; i < c.numWorkers; i++){
+			fds[i + 1].fd = c.workers[i].fd;
+			fds[i + 1].events = POLLIN;
+		}
+		if(poll(fds, c.numWorkers + 1, 1000) < 0){
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			ok = false;
+			break;
+		}
+
+		/* Downwards, so a dropped worker's place is taken by one already seen */
+		double late = now() - timeout;
+		for(i = c.numWorkers - 1; i >= 0; i--){
+			if(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)){
+				if(!receiveTile(&c, &c.workers[i]))
+					dropWorker(&c, i, "disconnected");
+			}else if(c.workers[i].numTiles > 0 && c.workers[i].heard < late)
+				dropWorker(&c, i, "timed out");
+		}
+		if(fds[0].revents & POLLIN)
+			addWorker(&c, listener, timeout);
+	}
+
+	/* Tell every worker there is no more, then read whatever it still
+	 * sends until it closes, so none is cut off mid-tile */
+	for(i = 0; i < c.numWorkers; i++){
+		int none = 0;
+		sendAll(c.workers[i].fd, &none, sizeof(int));
+	}
+	for(i = 0; i < c.numWorkers; i++){
+		while(recv(c.workers[i].fd, c.pixels, 3 * (size_t) tileSize * tileSize, 0) > 0)
+			;
+		close(c.workers[i].fd);
+		free(c.workers[i].tiles);
+	}
+	close(listener);
+	free(fds);
+	free(c.workers);
+	free(c.state);
+	free(c.holders);
+	free(c.backedUp);
+	free(c.issued);
+	free(c.queue);
+	free(c.pixels);
+	return ok;
+}
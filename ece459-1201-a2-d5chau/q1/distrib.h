@@ -0,0 +1,44 @@
+/* Tiles rendered by worker processes on this host or others.
+ *
+ * Workers connect to a coordinator at an address, either unix:<path> or
+ * <host>:<port>, and are sent the scene. The coordinator then sends each
+ * batches of tile numbers and workers send back the pixels of each tile
+ * as it is done. Tiles held by a worker that disconnects or goes quiet
+ * for too long are queued again, and once the queue is empty idle workers
+ * are given a second copy of tiles others are still on, so a slow worker
+ * cannot hold up the image. Scenes are sent in the machine's own layout,
+ * so every worker must be the same build on the same architecture.
+ */
+
+#ifndef DISTRIB_H
+#define DISTRIB_H
+
+#include "scene.h"
+
+/* Most tiles in one batch */
+#define MAX_BATCH 1024
+
+/* A socket listening at address, or -1 after printing the problem */
+int listenAt(const char *address);
+
+/* A socket connected to the coordinator at address, sending the hello
+ * of a worker with the given number of threads; -1 after printing the
+ * problem if there is none within a few seconds */
+int connectTo(const char *address, int threads);
+
+/* Receive the scene and check the coordinator uses tiles of tileSize */
+bool receiveScene(int fd, scene *sc, int tileSize);
+
+/* The next batch of at most maxTiles tile numbers, numbered row by row;
+ * a batch of none, or the coordinator closing, means there is no more */
+bool receiveBatch(int fd, int *tiles, int maxTiles, int *count);
+
+/* Send the w by h pixels of tile, packed row after row */
+bool sendTile(int fd, int tile, unsigned char *pixels, int w, int h);
+
+/* Hand out every tile of sc to workers connecting to listener until
+ * img holds the whole image; workers silent for timeout seconds while
+ * they hold tiles are dropped. Closes listener */
+bool coordinateTiles(int listener, scene *sc, int tileSize, double timeout, unsigned char *img);
+
+#endif
@@ -0,0 +1,377 @@
+/* Coherent ray packets intersected against spheres with SIMD.
+ *
+ * Each kernel evaluates intersectRaySphere's arithmetic lane by lane in
+ * the same order and with the same rounding: no FMA, sqrt and division
+ * are IEEE exact, and "t0 > t1" is resolved with a compare and blend
+ * rather than min, which treats NaN differently. A hit must be strictly
+ * closer, or equally close with a lower sphere index, so any order of
+ * spheres (a BVH leaf, say) keeps the answer of the scalar loop.
+ */
+
+#include <stdlib.h>
+#include "packet.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+sphereArrays allocSphereArrays(int count){
+	sphereArrays s;
+	s.x = malloc(count * sizeof(float));
+	s.y = malloc(count * sizeof(float));
+	s.z = malloc(count * sizeof(float));
+	s.radius = malloc(count * sizeof(float));
+	s.index = malloc(count * sizeof(int));
+	s.count = count;
+	return s;
+}
+
+sphereArrays makeSphereArrays(sphere *spheres, int count){
+	sphereArrays s = allocSphereArrays(count);
+	int i;
+	for(i = 0; i < count; i++){
+		s.x[i] = spheres[i].pos.x;
+		s.y[i] = spheres[i].pos.y;
+		s.z[i] = spheres[i].pos.z;
+		s.radius[i] = spheres[i].radius;
+		s.index[i] = i;
+	}
+	return s;
+}
+
+void freeSphereArrays(sphereArrays *s){
+	free(s->x);
+	free(s->y);
+	free(s->z);
+	free(s->radius);
+	free(s->index);
+}
+
+packetKernel selectPacketKernel(packetKernel requested){
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	int avx512 = __builtin_cpu_supports("avx512f");
+	int avx2 = __builtin_cpu_supports("avx2");
+	if(requested == KERNEL_SCALAR)
+		return KERNEL_SCALAR;
+	if(requested == KERNEL_AVX512 && avx512)
+		return KERNEL_AVX512;
+	if(requested == KERNEL_AVX2 && avx2)
+		return KERNEL_AVX2;
+	if(avx512)
+		return KERNEL_AVX512;
+	if(avx2)
+		return KERNEL_AVX2;
+#endif
+	return KERNEL_SCALAR;
+}
+
+const char *packetKernelName(packetKernel kernel){
+	switch(kernel){
+		case KERNEL_AVX512:
+			return "avx512";
+		case KERNEL_AVX2:
+			return "avx2";
+		default:
+			return "scalar";
+	}
+}
+
+int packetWidth(packetKernel kernel){
+	return kernel == KERNEL_AVX2 ? 8 : 16;
+}
+
+/* Reference kernel: the scalar intersection, one ray at a time */
+static void intersectScalar(sphereArrays *s, int first, int end, rayPacket *p){
+	int k, i;
+	for(k = 0; k < p->count; k++){
+		ray r;
+		r.start.x = p->startX[k];
+		r.start.y = p->startY[k];
+		r.start.z = p->startZ[k];
+		r.dir = p->dir;
+		for(i = first; i < end; i++){
+			sphere sp;
+			sp.pos.x = s->x[i];
+			sp.pos.y = s->y[i];
+			sp.pos.z = s->z[i];
+			sp.radius = s->radius[i];
+			intersectRaySphereIndexed(&r, &sp, s->index[i], &p->t[k], &p->hit[k]);
+		}
+	}
+}
+
+/* Reference batch kernel for rays from first on */
+static void intersectBatchScalar(sphereArrays *s, rayBatch *b, int first){
+	int k, i;
+	for(k = first; k < b->count; k++){
+		ray r;
+		r.start.x = b->startX[k];
+		r.start.y = b->startY[k];
+		r.start.z = b->startZ[k];
+		r.dir.x = b->dirX[k];
+		r.dir.y = b->dirY[k];
+		r.dir.z = b->dirZ[k];
+		for(i = 0; i < s->count; i++){
+			sphere sp;
+			sp.pos.x = s->x[i];
+			sp.pos.y = s->y[i];
+			sp.pos.z = s->z[i];
+			sp.radius = s->radius[i];
+			intersectRaySphereIndexed(&r, &sp, s->index[i], &b->t[k], &b->hit[k]);
+		}
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static void intersectAVX2(sphereArrays *s, int first, int end, rayPacket *p){
+	/* A = d.d is shared by the whole packet */
+	float A = vectorDot(&p->dir, &p->dir);
+	__m256 dirX = _mm256_set1_ps(p->dir.x);
+	__m256 dirY = _mm256_set1_ps(p->dir.y);
+	__m256 dirZ = _mm256_set1_ps(p->dir.z);
+	__m256 fourA = _mm256_set1_ps(4 * A);
+	__m256 two = _mm256_set1_ps(2);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 epsilon = _mm256_set1_ps(0.001f);
+	__m256 signBit = _mm256_set1_ps(-0.0f);
+	int base, i;
+
+	for(base = 0; base < p->count; base += 8){
+		__m256 startX = _mm256_loadu_ps(&p->startX[base]);
+		__m256 startY = _mm256_loadu_ps(&p->startY[base]);
+		__m256 startZ = _mm256_loadu_ps(&p->startZ[base]);
+		__m256 t = _mm256_loadu_ps(&p->t[base]);
+		__m256i hit = _mm256_loadu_si256((__m256i *) &p->hit[base]);
+
+		for(i = first; i < end; i++){
+			/* (p0 - c) */
+			__m256 distX = _mm256_sub_ps(startX, _mm256_set1_ps(s->x[i]));
+			__m256 distY = _mm256_sub_ps(startY, _mm256_set1_ps(s->y[i]));
+			__m256 distZ = _mm256_sub_ps(startZ, _mm256_set1_ps(s->z[i]));
+
+			/* B = 2d.(p0 - c) */
+			__m256 dirDotDist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, distX), _mm256_mul_ps(dirY, distY)), _mm256_mul_ps(dirZ, distZ));
+			__m256 B = _mm256_mul_ps(two, dirDotDist);
+
+			/* C = (p0 - c).(p0 - c) - r^2 */
+			__m256 distDotDist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(distX, distX), _mm256_mul_ps(distY, distY)), _mm256_mul_ps(distZ, distZ));
+			__m256 C = _mm256_sub_ps(distDotDist, _mm256_set1_ps(s->radius[i] * s->radius[i]));
+
+			__m256 discr = _mm256_sub_ps(_mm256_mul_ps(B, B), _mm256_mul_ps(fourA, C));
+			__m256 sqrtdiscr = _mm256_sqrt_ps(discr);
+			__m256 minusB = _mm256_xor_ps(B, signBit);
+			__m256 t0 = _mm256_div_ps(_mm256_add_ps(minusB, sqrtdiscr), two);
+			__m256 t1 = _mm256_div_ps(_mm256_sub_ps(minusB, sqrtdiscr), two);
+			t0 = _mm256_blendv_ps(t0, t1, _mm256_cmp_ps(t0, t1, _CMP_GT_OQ));
+
+			/* Not "discr < 0", in front of the start, and closer than the
+			 * hit so far or as close with a lower index */
+			__m256i index = _mm256_set1_epi32(s->index[i]);
+			__m256 tie = _mm256_and_ps(_mm256_cmp_ps(t0, t, _CMP_EQ_OQ), _mm256_castsi256_ps(_mm256_cmpgt_epi32(hit, index)));
+			__m256 closer = _mm256_or_ps(_mm256_cmp_ps(t0, t, _CMP_LT_OQ), tie);
+			__m256 take = _mm256_andnot_ps(_mm256_cmp_ps(discr, zero, _CMP_LT_OQ),
+					_mm256_and_ps(_mm256_cmp_ps(t0, epsilon, _CMP_GT_OQ), closer));
+			t = _mm256_blendv_ps(t, t0, take);
+			hit = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(hit), _mm256_castsi256_ps(index), take));
+		}
+		_mm256_storeu_ps(&p->t[base], t);
+		_mm256_storeu_si256((__m256i *) &p->hit[base], hit);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void intersectAVX512(sphereArrays *s, int first, int end, rayPacket *p){
+	/* A = d.d is shared by the whole packet */
+	float A = vectorDot(&p->dir, &p->dir);
+	__m512 dirX = _mm512_set1_ps(p->dir.x);
+	__m512 dirY = _mm512_set1_ps(p->dir.y);
+	__m512 dirZ = _mm512_set1_ps(p->dir.z);
+	__m512 fourA = _mm512_set1_ps(4 * A);
+	__m512 two = _mm512_set1_ps(2);
+	__m512 zero = _mm512_setzero_ps();
+	__m512 epsilon = _mm512_set1_ps(0.001f);
+	__m512i signBit = _mm512_set1_epi32(0x80000000);
+	int i;
+
+	__m512 startX = _mm512_loadu_ps(p->startX);
+	__m512 startY = _mm512_loadu_ps(p->startY);
+	__m512 startZ = _mm512_loadu_ps(p->startZ);
+	__m512 t = _mm512_loadu_ps(p->t);
+	__m512i hit = _mm512_loadu_si512(p->hit);
+
+	for(i = first; i < end; i++){
+		/* (p0 - c) */
+		__m512 distX = _mm512_sub_ps(startX, _mm512_set1_ps(s->x[i]));
+		__m512 distY = _mm512_sub_ps(startY, _mm512_set1_ps(s->y[i]));
+		__m512 distZ = _mm512_sub_ps(startZ, _mm512_set1_ps(s->z[i]));
+
+		/* B = 2d.(p0 - c) */
+		__m512 dirDotDist = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dirX, distX), _mm512_mul_ps(dirY, distY)), _mm512_mul_ps(dirZ, distZ));
+		__m512 B = _mm512_mul_ps(two, dirDotDist);
+
+		/* C = (p0 - c).(p0 - c) - r^2 */
+		__m512 distDotDist = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(distX, distX), _mm512_mul_ps(distY, distY)), _mm512_mul_ps(distZ, distZ));
+		__m512 C = _mm512_sub_ps(distDotDist, _mm512_set1_ps(s->radius[i] * s->radius[i]));
+
+		__m512 discr = _mm512_sub_ps(_mm512_mul_ps(B, B), _mm512_mul_ps(fourA, C));
+		__m512 sqrtdiscr = _mm512_sqrt_ps(discr);
+		__m512 minusB = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(B), signBit));
+		__m512 t0 = _mm512_div_ps(_mm512_add_ps(minusB, sqrtdiscr), two);
+		__m512 t1 = _mm512_div_ps(_mm512_sub_ps(minusB, sqrtdiscr), two);
+		t0 = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t0, t1, _CMP_GT_OQ), t0, t1);
+
+		/* Not "discr < 0", in front of the start, and closer than the
+		 * hit so far or as close with a lower index */
+		__m512i index = _mm512_set1_epi32(s->index[i]);
+		__mmask16 closer = _mm512_cmp_ps_mask(t0, t, _CMP_LT_OQ)
+				| (_mm512_cmp_ps_mask(t0, t, _CMP_EQ_OQ) & _mm512_cmpgt_epi32_mask(hit, index));
+		__mmask16 take = _mm512_cmp_ps_mask(discr, zero, _CMP_NLT_UQ)
+				& _mm512_cmp_ps_mask(t0, epsilon, _CMP_GT_OQ)
+				& closer;
+		t = _mm512_mask_blend_ps(take, t, t0);
+		hit = _mm512_mask_blend_epi32(take, hit, index);
+	}
+	_mm512_storeu_ps(p->t, t);
+	_mm512_storeu_si512(p->hit, hit);
+}
+
+/* As intersectAVX2, with a direction per lane; returns the rays done */
+__attribute__((target("avx2")))
+static int intersectBatchAVX2(sphereArrays *s, rayBatch *b){
+	__m256 two = _mm256_set1_ps(2);
+	__m256 four = _mm256_set1_ps(4);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 epsilon = _mm256_set1_ps(0.001f);
+	__m256 signBit = _mm256_set1_ps(-0.0f);
+	int base, i;
+
+	for(base = 0; base + 8 <= b->count; base += 8){
+		__m256 startX = _mm256_loadu_ps(&b->startX[base]);
+		__m256 startY = _mm256_loadu_ps(&b->startY[base]);
+		__m256 startZ = _mm256_loadu_ps(&b->startZ[base]);
+		__m256 dirX = _mm256_loadu_ps(&b->dirX[base]);
+		__m256 dirY = _mm256_loadu_ps(&b->dirY[base]);
+		__m256 dirZ = _mm256_loadu_ps(&b->dirZ[base]);
+		__m256 t = _mm256_loadu_ps(&b->t[base]);
+		__m256i hit = _mm256_loadu_si256((__m256i *) &b->hit[base]);
+
+		/* 4A, with A = d.d */
+		__m256 fourA = _mm256_mul_ps(four, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, dirX), _mm256_mul_ps(dirY, dirY)), _mm256_mul_ps(dirZ, dirZ)));
+
+		for(i = 0; i < s->count; i++){
+			__m256 distX = _mm256_sub_ps(startX, _mm256_set1_ps(s->x[i]));
+			__m256 distY = _mm256_sub_ps(startY, _mm256_set1_ps(s->y[i]));
+			__m256 distZ = _mm256_sub_ps(startZ, _mm256_set1_ps(s->z[i]));
+			__m256 dirDotDist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, distX), _mm256_mul_ps(dirY, distY)), _mm256_mul_ps(dirZ, distZ));
+			__m256 B = _mm256_mul_ps(two, dirDotDist);
+			__m256 distDotDist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(distX, distX), _mm256_mul_ps(distY, distY)), _mm256_mul_ps(distZ, distZ));
+			__m256 C = _mm256_sub_ps(distDotDist, _mm256_set1_ps(s->radius[i] * s->radius[i]));
+			__m256 discr = _mm256_sub_ps(_mm256_mul_ps(B, B), _mm256_mul_ps(fourA, C));
+			__m256 sqrtdiscr = _mm256_sqrt_ps(discr);
+			__m256 minusB = _mm256_xor_ps(B, signBit);
+			__m256 t0 = _mm256_div_ps(_mm256_add_ps(minusB, sqrtdiscr), two);
+			__m256 t1 = _mm256_div_ps(_mm256_sub_ps(minusB, sqrtdiscr), two);
+			t0 = _mm256_blendv_ps(t0, t1, _mm256_cmp_ps(t0, t1, _CMP_GT_OQ));
+
+			__m256i index = _mm256_set1_epi32(s->index[i]);
+			__m256 tie = _mm256_and_ps(_mm256_cmp_ps(t0, t, _CMP_EQ_OQ), _mm256_castsi256_ps(_mm256_cmpgt_epi32(hit, index)));
+			__m256 closer = _mm256_or_ps(_mm256_cmp_ps(t0, t, _CMP_LT_OQ), tie);
+			__m256 take = _mm256_andnot_ps(_mm256_cmp_ps(discr, zero, _CMP_LT_OQ),
+					_mm256_and_ps(_mm256_cmp_ps(t0, epsilon, _CMP_GT_OQ), closer));
+			t = _mm256_blendv_ps(t, t0, take);
+			hit = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(hit), _mm256_castsi256_ps(index), take));
+		}
+		_mm256_storeu_ps(&b->t[base], t);
+		_mm256_storeu_si256((__m256i *) &b->hit[base], hit);
+	}
+	return base;
+}
+
+/* As intersectAVX512, with a direction per lane; returns the rays done */
+__attribute__((target("avx512f")))
+static int intersectBatchAVX512(sphereArrays *s, rayBatch *b){
+	__m512 two = _mm512_set1_ps(2);
+	__m512 four = _mm512_set1_ps(4);
+	__m512 zero = _mm512_setzero_ps();
+	__m512 epsilon = _mm512_set1_ps(0.001f);
+	__m512i signBit = _mm512_set1_epi32(0x80000000);
+	int base, i;
+
+	for(base = 0; base + 16 <= b->count; base += 16){
+		__m512 startX = _mm512_loadu_ps(&b->startX[base]);
+		__m512 startY = _mm512_loadu_ps(&b->startY[base]);
+		__m512 startZ = _mm512_loadu_ps(&b->startZ[base]);
+		__m512 dirX = _mm512_loadu_ps(&b->dirX[base]);
+		__m512 dirY = _mm512_loadu_ps(&b->dirY[base]);
+		__m512 dirZ = _mm512_loadu_ps(&b->dirZ[base]);
+		__m512 t = _mm512_loadu_ps(&b->t[base]);
+		__m512i hit = _mm512_loadu_si512(&b->hit[base]);
+
+		/* 4A, with A = d.d */
+		__m512 fourA = _mm512_mul_ps(four, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dirX, dirX), _mm512_mul_ps(dirY, dirY)), _mm512_mul_ps(dirZ, dirZ)));
+
+		for(i = 0; i < s->count; i++){
+			__m512 distX = _mm512_sub_ps(startX, _mm512_set1_ps(s->x[i]));
+			__m512 distY = _mm512_sub_ps(startY, _mm512_set1_ps(s->y[i]));
+			__m512 distZ = _mm512_sub_ps(startZ, _mm512_set1_ps(s->z[i]));
+			__m512 dirDotDist = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dirX, distX), _mm512_mul_ps(dirY, distY)), _mm512_mul_ps(dirZ, distZ));
+			__m512 B = _mm512_mul_ps(two, dirDotDist);
+			__m512 distDotDist = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(distX, distX), _mm512_mul_ps(distY, distY)), _mm512_mul_ps(distZ, distZ));
+			__m512 C = _mm512_sub_ps(distDotDist, _mm512_set1_ps(s->radius[i] * s->radius[i]));
+			__m512 discr = _mm512_sub_ps(_mm512_mul_ps(B, B), _mm512_mul_ps(fourA, C));
+			__m512 sqrtdiscr = _mm512_sqrt_ps(discr);
+			__m512 minusB = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(B), signBit));
+			__m512 t0 = _mm512_div_ps(_mm512_add_ps(minusB, sqrtdiscr), two);
+			__m512 t1 = _mm512_div_ps(_mm512_sub_ps(minusB, sqrtdiscr), two);
+			t0 = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t0, t1, _CMP_GT_OQ), t0, t1);
+
+			__m512i index = _mm512_set1_epi32(s->index[i]);
+			__mmask16 closer = _mm512_cmp_ps_mask(t0, t, _CMP_LT_OQ)
+					| (_mm512_cmp_ps_mask(t0, t, _CMP_EQ_OQ) & _mm512_cmpgt_epi32_mask(hit, index));
+			__mmask16 take = _mm512_cmp_ps_mask(discr, zero, _CMP_NLT_UQ)
+					& _mm512_cmp_ps_mask(t0, epsilon, _CMP_GT_OQ)
+					& closer;
+			t = _mm512_mask_blend_ps(take, t, t0);
+			hit = _mm512_mask_blend_epi32(take, hit, index);
+		}
+		_mm512_storeu_ps(&b->t[base], t);
+		_mm512_storeu_si512(&b->hit[base], hit);
+	}
+	return base;
+}
+
+#endif
+
+void intersectPacketRange(packetKernel kernel, sphereArrays *s, int first, int count, rayPacket *p){
+#ifdef HAVE_X86_KERNELS
+	if(kernel == KERNEL_AVX512){
+		intersectAVX512(s, first, first + count, p);
+		return;
+	}
+	if(kernel == KERNEL_AVX2){
+		intersectAVX2(s, first, first + count, p);
+		return;
+	}
+#endif
+	intersectScalar(s, first, first + count, p);
+}
+
+void intersectPacket(packetKernel kernel, sphereArrays *s, rayPacket *p){
+	intersectPacketRange(kernel, s, 0, s->count, p);
+}
+
+void intersectBatch(packetKernel kernel, sphereArrays *s, rayBatch *b){
+	int done = 0;
+#ifdef HAVE_X86_KERNELS
+	if(kernel == KERNEL_AVX512)
+		done = intersectBatchAVX512(s, b);
+	else if(kernel == KERNEL_AVX2)
+		done = intersectBatchAVX2(s, b);
+#endif
+	/* Rays left over from the last full vector */
+	intersectBatchScalar(s, b, done);
+}
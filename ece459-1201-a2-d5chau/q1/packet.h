@@ -0,0 +1,69 @@
+/* Coherent ray packets intersected against spheres with SIMD */
+
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "raytrace.h"
+
+/* Largest packet any kernel traces at once */
+#define PACKET_MAX 16
+
+/* Spheres stored as structure of arrays, so one sphere's fields can be
+ * broadcast against every ray in a packet */
+typedef struct{
+	float *x, *y, *z, *radius;
+	int *index;	/* The sphere's index in the scene, reported as the hit */
+	int count;
+}sphereArrays;
+
+/* Up to PACKET_MAX rays with their own starts and one shared direction */
+typedef struct{
+	float startX[PACKET_MAX], startY[PACKET_MAX], startZ[PACKET_MAX];
+	vector dir;
+	int count;
+	float t[PACKET_MAX];	/* In: farthest distance; out: closest hit */
+	int hit[PACKET_MAX];	/* In: -1; out: index of the closest sphere, or -1 */
+}rayPacket;
+
+/* Rays with their own starts and directions, such as reflections */
+typedef struct{
+	float *startX, *startY, *startZ;
+	float *dirX, *dirY, *dirZ;
+	float *t;		/* In: farthest distance; out: closest hit */
+	int *hit;		/* In: -1; out: index of the closest sphere, or -1 */
+	int count;
+}rayBatch;
+
+typedef enum{
+	KERNEL_AUTO,
+	KERNEL_SCALAR,
+	KERNEL_AVX2,
+	KERNEL_AVX512
+}packetKernel;
+
+/* Uninitialised arrays for count spheres */
+sphereArrays allocSphereArrays(int count);
+
+/* Copy spheres into structure-of-arrays form; sphere i keeps index i */
+sphereArrays makeSphereArrays(sphere *spheres, int count);
+void freeSphereArrays(sphereArrays *s);
+
+/* The requested kernel if this CPU supports it, else the widest that it does */
+packetKernel selectPacketKernel(packetKernel requested);
+const char *packetKernelName(packetKernel kernel);
+
+/* Rays per packet the kernel is built for */
+int packetWidth(packetKernel kernel);
+
+/* Closest hit of every ray in the packet; the same result, bit for bit,
+ * as calling intersectRaySphereIndexed on each sphere */
+void intersectPacket(packetKernel kernel, sphereArrays *s, rayPacket *p);
+
+/* As intersectPacket, for spheres first to first + count - 1 only */
+void intersectPacketRange(packetKernel kernel, sphereArrays *s, int first, int count, rayPacket *p);
+
+/* Closest hit of every ray in the batch against every sphere, a kernel's
+ * width of rays at a time; the same result as intersectRaySphereIndexed */
+void intersectBatch(packetKernel kernel, sphereArrays *s, rayBatch *b);
+
+#endif
@@ -0,0 +1,143 @@
+/* PNG output compressed a band of rows at a time */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "pngwriter.h"
+
+/* PNG row filters */
+#define FILTER_NONE 0
+#define FILTER_SUB 1
+
+static void putBig32(unsigned char *p, unsigned long value){
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char) value;
+}
+
+/* Write a chunk of type with length bytes of data */
+static bool writeChunk(FILE *out, const char *type, const unsigned char *data, size_t length){
+	unsigned char head[8], tail[4];
+	putBig32(head, length);
+	memcpy(head + 4, type, 4);
+	/* crc32 takes a NULL buffer as asking for its initial value */
+	unsigned long crc = crc32(0L, head + 4, 4);
+	if(length > 0)
+		crc = crc32(crc, data, length);
+	putBig32(tail, crc);
+	return fwrite(head, 1, 8, out) == 8 && fwrite(data, 1, length, out) == length && fwrite(tail, 1, 4, out) == 4;
+}
+
+bool startPng(pngImage *png, FILE *out, int width, int height, int bandRows, int level){
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	unsigned char header[13];
+
+	png->width = width;
+	png->height = height;
+	png->bandRows = bandRows;
+	png->numBands = (height + bandRows - 1) / bandRows;
+	png->level = level;
+	png->adler = malloc(png->numBands * sizeof(unsigned long));
+	if(png->adler == NULL)
+		return false;
+
+	/* 8-bit RGB, deflate, adaptive filtering, no interlacing */
+	putBig32(header, width);
+	putBig32(header + 4, height);
+	header[8] = 8;
+	header[9] = 2;
+	header[10] = 0;
+	header[11] = 0;
+	header[12] = 0;
+
+	/* The zlib header: deflate with a 32K window and no dictionary, its
+	 * check bits making 0x7801 a multiple of 31 */
+	static const unsigned char zlibHeader[2] = {0x78, 0x01};
+	return fwrite(signature, 1, 8, out) == 8 && writeChunk(out, "IHDR", header, 13) && writeChunk(out, "IDAT", zlibHeader, 2);
+}
+
+/* Filter row into out: Sub where it makes the bytes smaller in the usual
+ * sum of absolute values, which favours runs of zeros, else None */
+static void filterRow(unsigned char *row, int width, unsigned char *out){
+	int bytes = 3 * width, i;
+	long none = 0, sub = 0;
+	for(i = 0; i < bytes; i++){
+		unsigned char d = row[i] - (i >= 3 ? row[i - 3] : 0);
+		none += row[i] < 128 ? row[i] : 256 - row[i];
+		sub += d < 128 ? d : 256 - d;
+	}
+	if(sub < none){
+		out[0] = FILTER_SUB;
+		for(i = 0; i < bytes; i++)
+			out[1 + i] = row[i] - (i >= 3 ? row[i - 3] : 0);
+	}else{
+		out[0] = FILTER_NONE;
+		memcpy(out + 1, row, bytes);
+	}
+}
+
+unsigned char *encodePngBand(pngImage *png, int band, unsigned char *rows, size_t *size){
+	int numRows = png->height - band * png->bandRows;
+	if(numRows > png->bandRows)
+		numRows = png->bandRows;
+	size_t stride = 1 + 3 * (size_t) png->width;
+	size_t length = stride * numRows;
+	unsigned char *filtered = malloc(length);
+	int row;
+	if(filtered == NULL)
+		return NULL;
+	for(row = 0; row < numRows; row++)
+		filterRow(rows + (size_t) row * 3 * png->width, png->width, filtered + row * stride);
+	png->adler[band] = adler32(adler32(0L, NULL, 0), filtered, length);
+
+	/* Raw deflate, so no band carries a zlib header or trailer of its
+	 * own; the sync flush ends it on a byte boundary without ending the
+	 * stream. The chunk's length and type go in front of it */
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if(deflateInit2(&z, png->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+		free(filtered);
+		return NULL;
+	}
+	size_t capacity = 8 + deflateBound(&z, length) + 16;
+	unsigned char *chunk = malloc(capacity);
+	int status = Z_OK;
+	z.next_in = filtered;
+	z.avail_in = length;
+	z.next_out = chunk + 8;
+	z.avail_out = capacity - 12;
+	if(chunk != NULL)
+		status = deflate(&z, Z_SYNC_FLUSH);
+	size_t compressed = z.total_out;
+	deflateEnd(&z);
+	free(filtered);
+	if(chunk == NULL || status != Z_OK || z.avail_in != 0 || z.avail_out == 0){
+		free(chunk);
+		return NULL;
+	}
+
+	putBig32(chunk, compressed);
+	memcpy(chunk + 4, "IDAT", 4);
+	putBig32(chunk + 8 + compressed, crc32(0L, chunk + 4, 4 + compressed));
+	*size = 12 + compressed;
+	return chunk;
+}
+
+bool finishPng(pngImage *png, FILE *out){
+	unsigned long adler = adler32(0L, NULL, 0);
+	size_t stride = 1 + 3 * (size_t) png->width;
+	int band;
+	for(band = 0; band < png->numBands; band++){
+		int numRows = png->height - band * png->bandRows;
+		if(numRows > png->bandRows)
+			numRows = png->bandRows;
+		adler = adler32_combine(adler, png->adler[band], stride * numRows);
+	}
+	free(png->adler);
+
+	/* An empty final block after the last flush ends the deflate stream */
+	unsigned char end[6] = {0x03, 0x00};
+	putBig32(end + 2, adler);
+	return writeChunk(out, "IDAT", end, 6) && writeChunk(out, "IEND", NULL, 0);
+}
@@ -0,0 +1,37 @@
+/* PNG output compressed a band of rows at a time.
+ *
+ * Each band is deflated on its own into an IDAT chunk that ends on a
+ * byte boundary with a sync flush, so bands can be compressed in parallel
+ * and in any order and still join into one zlib stream; the Adler-32 of
+ * the whole stream is combined from those of the bands when it ends.
+ * Rows are filtered with None or Sub, whichever suits each row, so no
+ * band depends on the rows of another.
+ */
+
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+typedef struct{
+	int width, height;
+	int bandRows;		/* Rows per band; the last band may be shorter */
+	int numBands;
+	int level;		/* zlib compression level */
+	unsigned long *adler;	/* Of each band's filtered rows */
+}pngImage;
+
+/* Write the PNG signature and header for width by height RGB pixels, to
+ * be compressed at level in bands of bandRows rows */
+bool startPng(pngImage *png, FILE *out, int width, int height, int bandRows, int level);
+
+/* The IDAT chunk for band, whose rows are packed RGB, in a buffer the
+ * caller frees, with its length in *size; NULL if zlib fails. Bands may
+ * be encoded at once from different threads */
+unsigned char *encodePngBand(pngImage *png, int band, unsigned char *rows, size_t *size);
+
+/* Once every band's chunk is written in order, end the stream and file */
+bool finishPng(pngImage *png, FILE *out);
+
+#endif
@@ -0,0 +1,132 @@
+/* Types and vector helpers shared by the ray tracer's translation units */
+/* Source: http://www.purplealienplanet.com/node/23 */
+
+#ifndef RAYTRACE_H
+#define RAYTRACE_H
+
+#include <stdbool.h> /* Needed for boolean datatype */
+#include <math.h>
+
+/* The vector structure */
+typedef struct{
+      float x,y,z;
+}vector;
+
+/* The sphere */
+typedef struct{
+        vector pos;
+        float  radius;
+	int material;
+}sphere; 
+
+/* The ray */
+typedef struct{
+        vector start;
+        vector dir;
+}ray;
+
+/* Colour */
+typedef struct{
+	float red, green, blue;
+}colour;
+
+/* Material Definition */
+typedef struct{
+	colour diffuse;
+	float reflection;
+}material;
+
+/* Lightsource definition */
+typedef struct{
+	vector pos;
+	colour intensity;
+}light;
+
+/* Subtract two vectors and return the resulting vector */
+static inline vector vectorSub(vector *v1, vector *v2){
+	vector result = {v1->x - v2->x, v1->y - v2->y, v1->z - v2->z };
+	return result;
+}
+
+/* Multiply two vectors and return the resulting scalar (dot product) */
+static inline float vectorDot(vector *v1, vector *v2){
+	return v1->x * v2->x + v1->y * v2->y + v1->z * v2->z;
+}
+
+/* Calculate Vector x Scalar and return resulting Vector*/ 
+static inline vector vectorScale(float c, vector *v){
+        vector result = {v->x * c, v->y * c, v->z * c };
+        return result;
+}
+
+/* Add two vectors and return the resulting vector */
+static inline vector vectorAdd(vector *v1, vector *v2){
+        vector result = {v1->x + v2->x, v1->y + v2->y, v1->z + v2->z };
+        return result;
+}
+
+/* Check if the ray and sphere intersect */
+static inline bool intersectRaySphere(ray *r, sphere *s, float *t){
+	
+	bool retval = false;
+
+	/* A = d.d, the vector dot product of the direction */
+	float A = vectorDot(&r->dir, &r->dir); 
+	
+	/* We need a vector representing the distance between the start of 
+	 * the ray and the position of the circle.
+	 * This is the term (p0 - c) 
+	 */
+	vector dist = vectorSub(&r->start, &s->pos);
+	
+	/* 2d.(p0 - c) */  
+	float B = 2 * vectorDot(&r->dir, &dist);
+	
+	/* (p0 - c).(p0 - c) - r^2 */
+	float C = vectorDot(&dist, &dist) - (s->radius * s->radius);
+	
+	/* Solving the discriminant */
+	float discr = B * B - 4 * A * C;
+	
+	/* If the discriminant is negative, there are no real roots.
+	 * Return false in that case as the ray misses the sphere.
+	 * Return true in all other cases (can be one or two intersections)
+	 * t represents the distance between the start of the ray and
+	 * the point on the sphere where it intersects.
+	 */
+	if(discr < 0)
+		retval = false;
+	else{
+		float sqrtdiscr = sqrtf(discr);
+		float t0 = (-B + sqrtdiscr)/(2);
+		float t1 = (-B - sqrtdiscr)/(2);
+		
+		/* We want the closest one */
+		if(t0 > t1)
+			t0 = t1;
+
+		/* Verify t1 larger than 0 and less than the original t */
+		if((t0 > 0.001f) && (t0 < *t)){
+			*t = t0;
+			retval = true;
+		}else
+			retval = false;
+	}
+
+return retval;
+}
+
+/* intersectRaySphere for a sphere known by its index: an equally close hit
+ * also wins if its index is lower than the current one, so the closest
+ * sphere is the same whatever order the spheres are tested in */
+static inline bool intersectRaySphereIndexed(ray *r, sphere *s, int index, float *t, int *hit){
+	float limit = (index < *hit) ? nextafterf(*t, INFINITY) : *t;
+	if(intersectRaySphere(r, s, &limit)){
+		*t = limit;
+		*hit = index;
+		return true;
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,1113 @@
+/* A simple ray tracer, rendered in parallel over tiles with OpenMP */
+/* Source: http://www.purplealienplanet.com/node/23 */
+/* Author writes: "The code is licensed under BSD, so use it however you want". */
+
+#include <stdio.h>
+#include <stdbool.h> /* Needed for boolean datatype */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <omp.h>
+#include "raytrace.h"
+#include "packet.h"
+#include "bvh.h"
+#include "scene.h"
+#include "bandwriter.h"
+#include "tilecull.h"
+#include "animation.h"
+#include "distrib.h"
+#include "pngwriter.h"
+#include "tilesched.h"
+
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+/* Square tiles handed out to threads one at a time */
+#define TILE_SIZE 32
+
+/* Bands of TILE_SIZE rows held per thread when streaming */
+#define SLOTS_PER_THREAD 2
+
+/* Tiles with more candidate spheres than this traverse the BVH instead */
+#define MAX_TILE_CANDIDATES 32
+
+/* Largest grid of extra samples an anti-aliased pixel can get */
+#define AA_MAX_GRID 8
+
+/* Wavefront rays batch-intersect every sphere in scenes this small */
+#define WAVEFRONT_BATCH_SPHERES 8
+
+/* Bounces counted separately in benchmarks; deeper ones share the last */
+#define STATS_LEVELS 16
+
+/* What one thread traced, padded so that threads never share a line */
+typedef struct{
+	long long primaryRays;
+	long long reflectedRays;
+	long long tests;	/* Ray-sphere intersection tests */
+	long long raysAtLevel[STATS_LEVELS];
+	char pad[64];
+}renderStats;
+
+/* Rays of one tile still bouncing, packed densely so every stage of the
+ * wavefront runs over a full batch */
+typedef struct{
+	float startX[TILE_SIZE * TILE_SIZE], startY[TILE_SIZE * TILE_SIZE], startZ[TILE_SIZE * TILE_SIZE];
+	float dirX[TILE_SIZE * TILE_SIZE], dirY[TILE_SIZE * TILE_SIZE], dirZ[TILE_SIZE * TILE_SIZE];
+	float t[TILE_SIZE * TILE_SIZE];
+	int hit[TILE_SIZE * TILE_SIZE];
+	float normalX[TILE_SIZE * TILE_SIZE], normalY[TILE_SIZE * TILE_SIZE], normalZ[TILE_SIZE * TILE_SIZE];
+	bool shade[TILE_SIZE * TILE_SIZE];	/* Hit a sphere this bounce */
+	float coef[TILE_SIZE * TILE_SIZE];
+	float red[TILE_SIZE * TILE_SIZE], green[TILE_SIZE * TILE_SIZE], blue[TILE_SIZE * TILE_SIZE];
+	int pixel[TILE_SIZE * TILE_SIZE];	/* (y - y0) * TILE_SIZE + x - x0 */
+	int count;
+}wavefront;
+
+/* What every tile is rendered with */
+typedef struct{
+	scene *sc;
+	bvh *accel;		/* NULL to test every sphere */
+	tileCandidates *cull;	/* Spheres each tile's primary rays can hit, or NULL */
+	sphereArrays *soa;
+	packetKernel kernel;
+	int packetWidth;
+	wavefront *wave;	/* One per thread for wavefront shading, or NULL */
+	int aaGrid;		/* Side of the grid for pixels that need more samples, or 0 */
+	float aaThreshold;	/* Corner colour variance that needs more samples */
+	renderStats *stats;	/* One per thread */
+	tileReach *reach;	/* Where each tile's rays went when animating, or NULL */
+	reachGrid grid;		/* Voxels the reach of each tile is kept in */
+	bool rowOrder;		/* Hand tiles out row by row from one queue */
+}renderer;
+
+/* Output data as PPM file */
+void saveppm(char *filename, unsigned char *img, int width, int height){
+	/* FILE pointer */
+	FILE *f;
+
+	/* Open file for writing */
+	f = fopen(filename, "w");
+
+	/* PPM header info, including the size of the image */
+	fprintf(f, "P6 %d %d %d\n", width, height, 255);
+
+	/* Write the image data to the file - remember 3 byte per pixel */
+	fwrite(img, 3, (size_t)width*height, f);
+
+	/* Make sure you close the file */
+	fclose(f);
+}
+
+/* Output data as PNG file, compressing bands of TILE_SIZE rows in
+ * parallel at zlib's level and writing each as soon as those before it
+ * are written */
+void savepng(char *filename, unsigned char *img, int width, int height, int level){
+	pngImage png;
+	int band;
+	FILE *f = fopen(filename, "w");
+	if(f == NULL){
+		perror(filename);
+		return;
+	}
+	bool ok = startPng(&png, f, width, height, TILE_SIZE, level);
+	if(ok){
+		#pragma omp parallel for ordered schedule(monotonic:dynamic)
+		for(band = 0; band < png.numBands; band++){
+			size_t size;
+			unsigned char *chunk = encodePngBand(&png, band, img + (size_t)band * TILE_SIZE * width * 3, &size);
+			#pragma omp ordered
+			if(ok && (chunk == NULL || fwrite(chunk, 1, size, f) != size))
+				ok = false;
+			free(chunk);
+		}
+		ok = finishPng(&png, f) && ok;
+	}
+	if(fclose(f) != 0 || !ok)
+		fprintf(stderr, "Failed writing %s\n", filename);
+}
+
+/* Whether filename asks for PNG rather than PPM */
+bool wantsPng(char *filename){
+	size_t length = strlen(filename);
+	return length >= 4 && strcasecmp(filename + length - 4, ".png") == 0;
+}
+
+/* Output data in the format filename's extension names */
+void saveImage(char *filename, unsigned char *img, int width, int height, int level){
+	if(wantsPng(filename))
+		savepng(filename, img, width, height, level);
+	else
+		saveppm(filename, img, width, height);
+}
+
+/* A band of rows compressed for the band writer */
+unsigned char *encodeBand(void *png, int band, unsigned char *rows, size_t *size){
+	return encodePngBand(png, band, rows, size);
+}
+
+/* Trace the ray from (x, y) and return the light it gathers; the primary
+ * hit (firstT, firstSphere) comes from the packet tracer. Reflected rays
+ * traverse the BVH, or test every sphere without one. Every segment is
+ * recorded in reach unless it is NULL */
+colour tracePixel(float x, float y, float firstT, int firstSphere, renderer *rd, tileReach *reach){
+	scene *sc = rd->sc;
+	bvh *accel = rd->accel;
+	renderStats *stats = &rd->stats[omp_get_thread_num()];
+	sphere *spheres = sc->spheres;
+	ray r;
+
+	float red = 0;
+	float green = 0;
+	float blue = 0;
+	
+	int level = 0;
+	float coef = 1.0;
+	
+	r.start.x = x;
+	r.start.y = y;
+	r.start.z = -2000;
+	
+	r.dir.x = 0;
+	r.dir.y = 0;
+	r.dir.z = 1;
+	
+	do{
+		/* Find closest intersection */
+		float t = firstT;
+		int currentSphere = firstSphere;
+		
+		/* Reflected rays are incoherent; trace them one at a time */
+		if(level > 0){
+			t = 20000.0f;
+			currentSphere = -1;
+			stats->reflectedRays++;
+			stats->raysAtLevel[min(level, STATS_LEVELS - 1)]++;
+			if(accel != NULL)
+				stats->tests += intersectBVH(accel, &r, &t, &currentSphere);
+			else{
+				int i;
+				for(i = 0; i < sc->numSpheres; i++)
+					intersectRaySphereIndexed(&r, &spheres[i], i, &t, &currentSphere);
+				stats->tests += sc->numSpheres;
+			}
+		}
+		if(reach != NULL)
+			addSegment(&rd->grid, reach, &r.start, &r.dir, t, currentSphere != -1);
+		if(currentSphere == -1) break;
+		
+		vector scaled = vectorScale(t, &r.dir);
+		vector newStart = vectorAdd(&r.start, &scaled);
+		
+		/* Find the normal for this new vector at the point of intersection */
+		vector n = vectorSub(&newStart, &spheres[currentSphere].pos);
+		float temp = vectorDot(&n, &n);
+		if(temp == 0) break;
+		
+		temp = 1.0f / sqrtf(temp);
+		n = vectorScale(temp, &n);
+
+		/* Find the material to determine the colour */
+		material currentMat = sc->materials[spheres[currentSphere].material];
+		
+		/* Find the value of the light at this point */
+		int j;
+		for(j=0; j < sc->numLights; j++){
+			light currentLight = sc->lights[j];
+			vector dist = vectorSub(&currentLight.pos, &newStart);
+			if(vectorDot(&n, &dist) <= 0.0f) continue;
+			float t = sqrtf(vectorDot(&dist,&dist));
+			if(t <= 0.0f) continue;
+			
+			ray lightRay;
+			lightRay.start = newStart;
+			lightRay.dir = vectorScale((1/t), &dist);
+			
+			/* Lambert diffusion */
+			float lambert = vectorDot(&lightRay.dir, &n) * coef; 
+			red += lambert * currentLight.intensity.red * currentMat.diffuse.red;
+			green += lambert * currentLight.intensity.green * currentMat.diffuse.green;
+			blue += lambert * currentLight.intensity.blue * currentMat.diffuse.blue;
+		}
+		/* Iterate over the reflection */
+		coef *= currentMat.reflection;
+		
+		/* The reflected ray start and direction */
+		r.start = newStart;
+		float reflect = 2.0f * vectorDot(&r.dir, &n);
+		vector tmp = vectorScale(reflect, &n);
+		r.dir = vectorSub(&r.dir, &tmp);
+
+		level++;
+
+	}while((coef > 0.0f) && (level < sc->maxDepth));
+	
+	colour c = {red, green, blue};
+	return c;
+}
+
+/* Trace the ray through pixel (x, y) and store its colour in out[0..2] */
+void renderPixel(int x, int y, float firstT, int firstSphere, renderer *rd, tileReach *reach, unsigned char *out){
+	colour c = tracePixel(x, y, firstT, firstSphere, rd, reach);
+	out[0] = (unsigned char)min(c.red*255.0f, 255.0f);
+	out[1] = (unsigned char)min(c.green*255.0f, 255.0f);
+	out[2] = (unsigned char)min(c.blue*255.0f, 255.0f);
+}
+
+/* Candidates for primary rays in the tile at (x0, y0): how many, starting
+ * at *first, or -1 if they should traverse the BVH or test every sphere */
+int primaryCandidates(renderer *rd, int x0, int y0, int *first){
+	*first = 0;
+	if(rd->cull == NULL)
+		return -1;
+	int tile = (y0 / TILE_SIZE) * rd->cull->tilesX + x0 / TILE_SIZE;
+	*first = rd->cull->start[tile];
+	int candidates = rd->cull->start[tile + 1] - *first;
+	return candidates > MAX_TILE_CANDIDATES ? -1 : candidates;
+}
+
+/* Where the rays of the tile at (x0, y0) are recorded, or NULL */
+tileReach *reachOf(renderer *rd, int x0, int y0){
+	if(rd->reach == NULL)
+		return NULL;
+	int tilesX = (rd->sc->width + TILE_SIZE - 1) / TILE_SIZE;
+	return &rd->reach[(y0 / TILE_SIZE) * tilesX + x0 / TILE_SIZE];
+}
+
+/* Closest hits of a packet of primary rays. With few candidates, test
+ * just those; with none, every ray misses and need not be traced */
+void intersectPrimaries(renderer *rd, int first, int candidates, rayPacket *packet){
+	renderStats *stats = &rd->stats[omp_get_thread_num()];
+	stats->primaryRays += packet->count;
+	stats->raysAtLevel[0] += packet->count;
+	if(candidates == 0)
+		;
+	else if(candidates > 0){
+		intersectPacketRange(rd->kernel, &rd->cull->soa, first, candidates, packet);
+		stats->tests += (long long)candidates * packet->count;
+	}else if(rd->accel != NULL)
+		stats->tests += intersectPacketBVH(rd->kernel, rd->accel, packet);
+	else{
+		intersectPacket(rd->kernel, rd->soa, packet);
+		stats->tests += (long long)rd->soa->count * packet->count;
+	}
+}
+
+/* Trace the primary rays of the tile at (x0, y0) a row at a time, storing
+ * pixel (x, y)'s closest hit at (y - y0) * TILE_SIZE + x - x0 */
+void tracePrimaries(renderer *rd, int x0, int y0, float *t, int *hit){
+	scene *sc = rd->sc;
+	int x, y, k, first;
+	int candidates = primaryCandidates(rd, x0, y0, &first);
+	rayPacket packet;
+	packet.dir.x = 0;
+	packet.dir.y = 0;
+	packet.dir.z = 1;
+
+	for(y = y0; y < min(y0 + TILE_SIZE, sc->height); y++){
+		for(x = x0; x < min(x0 + TILE_SIZE, sc->width); x += rd->packetWidth){
+			packet.count = min(rd->packetWidth, min(x0 + TILE_SIZE, sc->width) - x);
+			/* Unused lanes repeat the last ray so every lane holds real data */
+			for(k = 0; k < PACKET_MAX; k++){
+				packet.startX[k] = x + min(k, packet.count - 1);
+				packet.startY[k] = y;
+				packet.startZ[k] = -2000;
+				packet.t[k] = 20000.0f;
+				packet.hit[k] = -1;
+			}
+			intersectPrimaries(rd, first, candidates, &packet);
+			for(k = 0; k < packet.count; k++){
+				t[(y - y0) * TILE_SIZE + x - x0 + k] = packet.t[k];
+				hit[(y - y0) * TILE_SIZE + x - x0 + k] = packet.hit[k];
+			}
+		}
+	}
+}
+
+/* Trace and shade primary rays from count points within half a pixel of
+ * the tile at (x0, y0), clamping each colour to what a pixel can show */
+void shadeSamples(renderer *rd, int x0, int y0, float *sampleX, float *sampleY, int count, colour *out){
+	int base, k, first;
+	int candidates = primaryCandidates(rd, x0, y0, &first);
+	rayPacket packet;
+	packet.dir.x = 0;
+	packet.dir.y = 0;
+	packet.dir.z = 1;
+
+	for(base = 0; base < count; base += rd->packetWidth){
+		packet.count = min(rd->packetWidth, count - base);
+		for(k = 0; k < PACKET_MAX; k++){
+			packet.startX[k] = sampleX[base + min(k, packet.count - 1)];
+			packet.startY[k] = sampleY[base + min(k, packet.count - 1)];
+			packet.startZ[k] = -2000;
+			packet.t[k] = 20000.0f;
+			packet.hit[k] = -1;
+		}
+		intersectPrimaries(rd, first, candidates, &packet);
+		for(k = 0; k < packet.count; k++){
+			colour c = tracePixel(packet.startX[k], packet.startY[k], packet.t[k], packet.hit[k], rd, reachOf(rd, x0, y0));
+			out[base + k].red = min(c.red, 1.0f);
+			out[base + k].green = min(c.green, 1.0f);
+			out[base + k].blue = min(c.blue, 1.0f);
+		}
+	}
+}
+
+/* Anti-alias the tile at (x0, y0). Shading the corners of every pixel
+ * costs about one ray per pixel and gives each pixel four samples; a pixel
+ * whose corners vary by more than the threshold, such as one on a
+ * silhouette, then gets an aaGrid by aaGrid pattern as well. Tiles trace
+ * their own edge corners, so neighbouring tiles agree without sharing */
+void renderTileAdaptive(renderer *rd, int x0, int y0, unsigned char *rows, int rowsY0){
+	scene *sc = rd->sc;
+	int w = min(TILE_SIZE, sc->width - x0);
+	int h = min(TILE_SIZE, sc->height - y0);
+	float sampleX[(TILE_SIZE + 1) * (TILE_SIZE + 1)], sampleY[(TILE_SIZE + 1) * (TILE_SIZE + 1)];
+	colour corner[(TILE_SIZE + 1) * (TILE_SIZE + 1)];
+	colour extra[AA_MAX_GRID * AA_MAX_GRID];
+	int n = rd->aaGrid;
+	int i, j, x, y;
+
+	for(j = 0; j <= h; j++)
+		for(i = 0; i <= w; i++){
+			sampleX[j * (w + 1) + i] = x0 + i - 0.5f;
+			sampleY[j * (w + 1) + i] = y0 + j - 0.5f;
+		}
+	shadeSamples(rd, x0, y0, sampleX, sampleY, (w + 1) * (h + 1), corner);
+
+	for(y = 0; y < h; y++){
+		unsigned char *row = rows + (size_t)(y0 + y - rowsY0) * sc->width * 3;
+		for(x = 0; x < w; x++){
+			colour *c[4] = {&corner[y * (w + 1) + x], &corner[y * (w + 1) + x + 1],
+					&corner[(y + 1) * (w + 1) + x], &corner[(y + 1) * (w + 1) + x + 1]};
+			colour sum = {0, 0, 0}, square = {0, 0, 0};
+			int samples = 4;
+			for(i = 0; i < 4; i++){
+				sum.red += c[i]->red;
+				sum.green += c[i]->green;
+				sum.blue += c[i]->blue;
+				square.red += c[i]->red * c[i]->red;
+				square.green += c[i]->green * c[i]->green;
+				square.blue += c[i]->blue * c[i]->blue;
+			}
+			float variance = (square.red - sum.red * sum.red / 4) / 4
+					+ (square.green - sum.green * sum.green / 4) / 4
+					+ (square.blue - sum.blue * sum.blue / 4) / 4;
+
+			/* Stratified samples at the centres of an n by n grid */
+			if(variance > rd->aaThreshold){
+				for(j = 0; j < n; j++)
+					for(i = 0; i < n; i++){
+						sampleX[j * n + i] = x0 + x - 0.5f + (i + 0.5f) / n;
+						sampleY[j * n + i] = y0 + y - 0.5f + (j + 0.5f) / n;
+					}
+				shadeSamples(rd, x0, y0, sampleX, sampleY, n * n, extra);
+				for(i = 0; i < n * n; i++){
+					sum.red += extra[i].red;
+					sum.green += extra[i].green;
+					sum.blue += extra[i].blue;
+				}
+				samples += n * n;
+			}
+			unsigned char *out = row + (x0 + x) * 3;
+			out[0] = (unsigned char)(sum.red / samples * 255.0f);
+			out[1] = (unsigned char)(sum.green / samples * 255.0f);
+			out[2] = (unsigned char)(sum.blue / samples * 255.0f);
+		}
+	}
+}
+
+/* Shade a tile's rays bounce by bounce, each stage running over every ray
+ * still alive, and compact the survivors after each bounce. Every ray
+ * does exactly the arithmetic renderPixel does, so the image is the same */
+void shadeWavefront(renderer *rd, int x0, int y0, float *firstT, int *firstSphere, unsigned char *rows, int rowsY0){
+	scene *sc = rd->sc;
+	wavefront *w = &rd->wave[omp_get_thread_num()];
+	renderStats *stats = &rd->stats[omp_get_thread_num()];
+	tileReach *reach = reachOf(rd, x0, y0);
+	int i, j, x, y;
+	int level = 0;
+
+	w->count = 0;
+	for(y = y0; y < min(y0 + TILE_SIZE, sc->height); y++){
+		for(x = x0; x < min(x0 + TILE_SIZE, sc->width); x++){
+			int pixel = (y - y0) * TILE_SIZE + x - x0;
+
+			/* A primary miss is black and never joins the wavefront */
+			if(firstSphere[pixel] == -1){
+				memset(rows + ((size_t)(y - rowsY0) * sc->width + x) * 3, 0, 3);
+				if(reach != NULL){
+					vector start = {x, y, -2000}, dir = {0, 0, 1};
+					addSegment(&rd->grid, reach, &start, &dir, firstT[pixel], false);
+				}
+				continue;
+			}
+			i = w->count++;
+			w->startX[i] = x;
+			w->startY[i] = y;
+			w->startZ[i] = -2000;
+			w->dirX[i] = 0;
+			w->dirY[i] = 0;
+			w->dirZ[i] = 1;
+			w->t[i] = firstT[pixel];
+			w->hit[i] = firstSphere[pixel];
+			w->coef[i] = 1.0;
+			w->red[i] = 0;
+			w->green[i] = 0;
+			w->blue[i] = 0;
+			w->pixel[i] = pixel;
+		}
+	}
+
+	while(w->count > 0){
+		/* Closest intersections; the primary ones are already known */
+		if(level > 0){
+			for(i = 0; i < w->count; i++){
+				w->t[i] = 20000.0f;
+				w->hit[i] = -1;
+			}
+			stats->reflectedRays += w->count;
+			stats->raysAtLevel[min(level, STATS_LEVELS - 1)] += w->count;
+			if(rd->accel == NULL || sc->numSpheres <= WAVEFRONT_BATCH_SPHERES){
+				rayBatch batch = {w->startX, w->startY, w->startZ, w->dirX, w->dirY, w->dirZ, w->t, w->hit, w->count};
+				intersectBatch(rd->kernel, rd->soa, &batch);
+				stats->tests += (long long)rd->soa->count * w->count;
+			}else{
+				for(i = 0; i < w->count; i++){
+					ray r = {{w->startX[i], w->startY[i], w->startZ[i]}, {w->dirX[i], w->dirY[i], w->dirZ[i]}};
+					stats->tests += intersectBVH(rd->accel, &r, &w->t[i], &w->hit[i]);
+				}
+			}
+		}
+		if(reach != NULL){
+			for(i = 0; i < w->count; i++){
+				vector start = {w->startX[i], w->startY[i], w->startZ[i]};
+				vector dir = {w->dirX[i], w->dirY[i], w->dirZ[i]};
+				addSegment(&rd->grid, reach, &start, &dir, w->t[i], w->hit[i] != -1);
+			}
+		}
+
+		/* Move to the hit and find the normal there */
+		for(i = 0; i < w->count; i++){
+			w->shade[i] = false;
+			if(w->hit[i] == -1)
+				continue;
+			w->startX[i] = w->startX[i] + w->dirX[i] * w->t[i];
+			w->startY[i] = w->startY[i] + w->dirY[i] * w->t[i];
+			w->startZ[i] = w->startZ[i] + w->dirZ[i] * w->t[i];
+			sphere *s = &sc->spheres[w->hit[i]];
+			float nX = w->startX[i] - s->pos.x;
+			float nY = w->startY[i] - s->pos.y;
+			float nZ = w->startZ[i] - s->pos.z;
+			float temp = nX * nX + nY * nY + nZ * nZ;
+			if(temp == 0)
+				continue;
+			temp = 1.0f / sqrtf(temp);
+			w->normalX[i] = nX * temp;
+			w->normalY[i] = nY * temp;
+			w->normalZ[i] = nZ * temp;
+			w->shade[i] = true;
+		}
+
+		/* Lambert diffusion, one light at a time over every ray */
+		for(j = 0; j < sc->numLights; j++){
+			light *l = &sc->lights[j];
+			for(i = 0; i < w->count; i++){
+				if(!w->shade[i])
+					continue;
+				float distX = l->pos.x - w->startX[i];
+				float distY = l->pos.y - w->startY[i];
+				float distZ = l->pos.z - w->startZ[i];
+				if(w->normalX[i] * distX + w->normalY[i] * distY + w->normalZ[i] * distZ <= 0.0f)
+					continue;
+				float t = sqrtf(distX * distX + distY * distY + distZ * distZ);
+				if(t <= 0.0f)
+					continue;
+				float inverse = 1 / t;
+				float lambert = (distX * inverse * w->normalX[i] + distY * inverse * w->normalY[i] + distZ * inverse * w->normalZ[i]) * w->coef[i];
+				material *m = &sc->materials[sc->spheres[w->hit[i]].material];
+				w->red[i] += lambert * l->intensity.red * m->diffuse.red;
+				w->green[i] += lambert * l->intensity.green * m->diffuse.green;
+				w->blue[i] += lambert * l->intensity.blue * m->diffuse.blue;
+			}
+		}
+
+		/* Reflect */
+		for(i = 0; i < w->count; i++){
+			if(!w->shade[i])
+				continue;
+			w->coef[i] *= sc->materials[sc->spheres[w->hit[i]].material].reflection;
+			float reflect = 2.0f * (w->dirX[i] * w->normalX[i] + w->dirY[i] * w->normalY[i] + w->dirZ[i] * w->normalZ[i]);
+			w->dirX[i] = w->dirX[i] - w->normalX[i] * reflect;
+			w->dirY[i] = w->dirY[i] - w->normalY[i] * reflect;
+			w->dirZ[i] = w->dirZ[i] - w->normalZ[i] * reflect;
+		}
+		level++;
+
+		/* Finished rays write their pixel; the rest close up in order */
+		int alive = 0;
+		for(i = 0; i < w->count; i++){
+			if(w->shade[i] && w->coef[i] > 0.0f && level < sc->maxDepth){
+				w->startX[alive] = w->startX[i];
+				w->startY[alive] = w->startY[i];
+				w->startZ[alive] = w->startZ[i];
+				w->dirX[alive] = w->dirX[i];
+				w->dirY[alive] = w->dirY[i];
+				w->dirZ[alive] = w->dirZ[i];
+				w->coef[alive] = w->coef[i];
+				w->red[alive] = w->red[i];
+				w->green[alive] = w->green[i];
+				w->blue[alive] = w->blue[i];
+				w->pixel[alive] = w->pixel[i];
+				alive++;
+			}else{
+				x = x0 + w->pixel[i] % TILE_SIZE;
+				y = y0 + w->pixel[i] / TILE_SIZE;
+				unsigned char *out = rows + ((size_t)(y - rowsY0) * sc->width + x) * 3;
+				out[0] = (unsigned char)min(w->red[i]*255.0f, 255.0f);
+				out[1] = (unsigned char)min(w->green[i]*255.0f, 255.0f);
+				out[2] = (unsigned char)min(w->blue[i]*255.0f, 255.0f);
+			}
+		}
+		w->count = alive;
+	}
+}
+
+/* Render the tile at (x0, y0) into rows, which holds image rows from
+ * rowsY0 on */
+void renderTile(renderer *rd, int x0, int y0, unsigned char *rows, int rowsY0){
+	scene *sc = rd->sc;
+	float t[TILE_SIZE * TILE_SIZE];
+	int hit[TILE_SIZE * TILE_SIZE];
+	int x, y;
+	tileReach *reach = reachOf(rd, x0, y0);
+
+	if(reach != NULL)
+		clearReach(&rd->grid, reach);
+	if(rd->aaGrid > 0){
+		renderTileAdaptive(rd, x0, y0, rows, rowsY0);
+		return;
+	}
+	tracePrimaries(rd, x0, y0, t, hit);
+	if(rd->wave != NULL){
+		shadeWavefront(rd, x0, y0, t, hit, rows, rowsY0);
+		return;
+	}
+	for(y = y0; y < min(y0 + TILE_SIZE, sc->height); y++){
+		unsigned char *row = rows + (size_t)(y - rowsY0) * sc->width * 3;
+		for(x = x0; x < min(x0 + TILE_SIZE, sc->width); x++){
+			int pixel = (y - y0) * TILE_SIZE + x - x0;
+			renderPixel(x, y, t[pixel], hit[pixel], rd, reach, row + x * 3);
+		}
+	}
+}
+
+/* Render the count tiles listed into img. Each thread works through its
+ * own stretch of them in Z-order, stealing from others once it is done;
+ * rowOrder, or too little memory, hands them out one at a time in the
+ * order given instead */
+void renderTiles(renderer *rd, int *tiles, int count, unsigned char *img){
+	int tilesX = (rd->sc->width + TILE_SIZE - 1) / TILE_SIZE;
+	tileScheduler sched;
+	int i;
+	if(rd->rowOrder || !startTileScheduler(&sched, tiles, count, tilesX, omp_get_max_threads())){
+		#pragma omp parallel for schedule(dynamic)
+		for(i = 0; i < count; i++)
+			renderTile(rd, (tiles[i] % tilesX) * TILE_SIZE, (tiles[i] / tilesX) * TILE_SIZE, img, 0);
+		return;
+	}
+	#pragma omp parallel private(i)
+	while(nextTile(&sched, omp_get_thread_num(), &i))
+		renderTile(rd, (i % tilesX) * TILE_SIZE, (i / tilesX) * TILE_SIZE, img, 0);
+	freeTileScheduler(&sched);
+}
+
+/* Build what tracing the scene as it stands needs: its spheres as arrays
+ * and, unless linear, the BVH and each tile's primary candidates. Primary
+ * rays test their tile's candidates, or traverse the BVH where a tile has
+ * too many, and reflected rays always traverse it; -l keeps the linear
+ * scan as a reference */
+void prepareScene(renderer *rd, bool linear){
+	scene *sc = rd->sc;
+	rd->soa = malloc(sizeof(sphereArrays));
+	*rd->soa = makeSphereArrays(sc->spheres, sc->numSpheres);
+	rd->accel = NULL;
+	rd->cull = NULL;
+	if(!linear){
+		rd->accel = malloc(sizeof(bvh));
+		*rd->accel = buildBVH(sc->spheres, sc->numSpheres);
+		rd->cull = malloc(sizeof(tileCandidates));
+		*rd->cull = buildTileCandidates(sc, TILE_SIZE);
+	}
+}
+
+void releaseScene(renderer *rd){
+	freeSphereArrays(rd->soa);
+	free(rd->soa);
+	if(rd->accel != NULL){
+		freeBVH(rd->accel);
+		free(rd->accel);
+	}
+	if(rd->cull != NULL){
+		freeTileCandidates(rd->cull);
+		free(rd->cull);
+	}
+}
+
+/* Render each frame of anim to the file the printf pattern names for its
+ * number. The image of one frame is kept for the next, where only the
+ * tiles whose rays could meet a changed sphere, or that a changed light
+ * shines on, are traced again; full traces every tile of every frame as
+ * a reference. Time spent setting up, rendering and writing is added to
+ * the three times */
+void renderAnimation(renderer *rd, animation *anim, char *pattern, bool linear, bool full, int level, double *times){
+	scene *sc = rd->sc;
+	int tilesX = (sc->width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (sc->height + TILE_SIZE - 1) / TILE_SIZE;
+	int numTiles = tilesX * tilesY;
+	unsigned char *img = malloc(3*(size_t)sc->width*sc->height*sizeof(unsigned char));
+	int *dirty = malloc(numTiles * sizeof(int));
+	sphere *before = malloc(sc->numSpheres * sizeof(sphere));
+	light *lightsBefore = malloc(sc->numLights * sizeof(light));
+	char name[4096];
+	int frame, i;
+
+	rd->grid = animationReach(anim, sc, numTiles);
+	rd->reach = allocReach(&rd->grid, numTiles);
+	for(frame = 0; frame < anim->numFrames; frame++){
+		double started = omp_get_wtime();
+		int numDirty = numTiles;
+		poseScene(anim, frame, sc);
+		if(frame > 0 && !full)
+			numDirty = findDirtyTiles(&rd->grid, rd->reach, numTiles, before, lightsBefore, sc, dirty);
+		else
+			for(i = 0; i < numTiles; i++)
+				dirty[i] = i;
+		if(numDirty > 0)
+			prepareScene(rd, linear);
+
+		double rendering = omp_get_wtime();
+		renderTiles(rd, dirty, numDirty, img);
+		if(numDirty > 0)
+			releaseScene(rd);
+
+		double writing = omp_get_wtime();
+		snprintf(name, sizeof(name), pattern, frame);
+		saveImage(name, img, sc->width, sc->height, level);
+		memcpy(before, sc->spheres, sc->numSpheres * sizeof(sphere));
+		memcpy(lightsBefore, sc->lights, sc->numLights * sizeof(light));
+		times[0] += rendering - started;
+		times[1] += writing - rendering;
+		times[2] += omp_get_wtime() - writing;
+	}
+	freeReach(rd->reach);
+	rd->reach = NULL;
+	free(img);
+	free(dirty);
+	free(before);
+	free(lightsBefore);
+}
+
+/* Render the batches of tiles the coordinator on fd sends until it has no
+ * more, sending each tile back as soon as it is done */
+bool runWorker(renderer *rd, int fd){
+	scene *sc = rd->sc;
+	int tilesX = (sc->width + TILE_SIZE - 1) / TILE_SIZE;
+	int *tiles = malloc(MAX_BATCH * sizeof(int));
+	int count, i;
+	bool ok = true;
+
+	while(ok){
+		if(!receiveBatch(fd, tiles, MAX_BATCH, &count))
+			ok = false;
+		if(count == 0)
+			break;
+		#pragma omp parallel private(i)
+		{
+			/* renderTile writes into rows of the whole image's width */
+			unsigned char *band = malloc(3 * (size_t)sc->width * TILE_SIZE);
+			unsigned char *packed = malloc(3 * TILE_SIZE * TILE_SIZE);
+			#pragma omp for schedule(dynamic)
+			for(i = 0; i < count; i++){
+				int x0 = (tiles[i] % tilesX) * TILE_SIZE;
+				int y0 = (tiles[i] / tilesX) * TILE_SIZE;
+				int w = min(TILE_SIZE, sc->width - x0);
+				int h = min(TILE_SIZE, sc->height - y0);
+				int y;
+				renderTile(rd, x0, y0, band, y0);
+				for(y = 0; y < h; y++)
+					memcpy(packed + y * w * 3, band + ((size_t)y * sc->width + x0) * 3, w * 3);
+				#pragma omp critical(sendTile)
+				if(ok && !sendTile(fd, tiles[i], packed, w, h))
+					ok = false;
+			}
+			free(band);
+			free(packed);
+		}
+	}
+	if(!ok)
+		fprintf(stderr, "Lost the coordinator\n");
+	free(tiles);
+	return ok;
+}
+
+/* Append a row of benchmark results to the CSV file at path, starting the
+ * file with a header if it is new. Times are in seconds; mode names how
+ * the image was traced, shaded, written and scheduled */
+bool appendBenchmark(char *path, char *sceneName, renderer *rd, char *mode, double setup, double render, double output){
+	renderStats total;
+	int i, level;
+	memset(&total, 0, sizeof(total));
+	for(i = 0; i < omp_get_max_threads(); i++){
+		total.primaryRays += rd->stats[i].primaryRays;
+		total.reflectedRays += rd->stats[i].reflectedRays;
+		total.tests += rd->stats[i].tests;
+		for(level = 0; level < STATS_LEVELS; level++)
+			total.raysAtLevel[level] += rd->stats[i].raysAtLevel[level];
+	}
+
+	FILE *f = fopen(path, "a");
+	if(f == NULL){
+		perror(path);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	if(ftell(f) == 0)
+		fprintf(f, "scene,width,height,spheres,threads,kernel,mode,setup_s,render_s,output_s,"
+				"primary_rays,reflected_rays,intersection_tests,rays_per_s,rays_by_level\n");
+	fprintf(f, "%s,%d,%d,%d,%d,%s,%s,%.6f,%.6f,%.6f,%lld,%lld,%lld,%.0f,",
+			sceneName, rd->sc->width, rd->sc->height, rd->sc->numSpheres, omp_get_max_threads(),
+			packetKernelName(rd->kernel), mode, setup, render, output,
+			total.primaryRays, total.reflectedRays, total.tests,
+			render > 0 ? (total.primaryRays + total.reflectedRays) / render : 0);
+
+	/* Rays at each bounce up to the deepest reached, separated by ';' */
+	int deepest = 0;
+	for(level = 0; level < STATS_LEVELS; level++)
+		if(total.raysAtLevel[level] > 0)
+			deepest = level;
+	for(level = 0; level <= deepest; level++)
+		fprintf(f, level == 0 ? "%lld" : ";%lld", total.raysAtLevel[level]);
+	fprintf(f, "\n");
+	if(fclose(f) != 0){
+		perror(path);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]){
+
+	char *filename = NULL;
+	packetKernel requested = KERNEL_AUTO;
+	char *sceneFile = NULL;
+	bool linear = false;
+	bool stream = false;
+	bool wave = false;
+	int samples = 1;
+	float threshold = 0.001f;
+	char *benchFile = NULL;
+	char *animationFile = NULL;
+	bool full = false;
+	bool rowOrder = false;
+	char *coordinateAt = NULL;
+	char *workFor = NULL;
+	int localWorkers = 0;
+	double timeout = 60;
+	int level = 6;
+	int c, i;
+	while((c = getopt(argc, argv, "o:t:k:ls:bwS:V:B:a:fC:W:j:T:z:r")) != -1){
+		switch(c){
+			case 'C':
+				/* Hand tiles to workers connecting at unix:<path> or <host>:<port> */
+				coordinateAt = optarg;
+				break;
+			case 'W':
+				/* Render tiles for the coordinator at this address */
+				workFor = optarg;
+				break;
+			case 'j':
+				/* Workers a coordinator starts on this host */
+				localWorkers = atoi(optarg);
+				break;
+			case 'T':
+				/* Seconds a worker holding tiles may go quiet before they
+				 * are given to others */
+				timeout = atof(optarg);
+				break;
+			case 'a':
+				/* Render the frames a keyframe script moves the scene through */
+				animationFile = optarg;
+				break;
+			case 'r':
+				/* Hand tiles out row by row from one shared queue
+				 * rather than in Z-order with stealing */
+				rowOrder = true;
+				break;
+			case 'f':
+				/* Trace every tile of every frame, not just what changed */
+				full = true;
+				break;
+			case 'B':
+				/* Append rays traced and time per phase to a CSV file */
+				benchFile = optarg;
+				break;
+			case 'S':
+				/* Samples a pixel may get when anti-aliasing: up to 4
+				 * corners plus a square grid, so 5, 8, 13, ... 68 */
+				samples = atoi(optarg);
+				break;
+			case 'V':
+				/* Corner colour variance above which a pixel gets the grid */
+				threshold = atof(optarg);
+				break;
+			case 'w':
+				/* Shade tiles bounce by bounce rather than pixel by pixel */
+				wave = true;
+				break;
+			case 'b':
+				/* Stream bands of rows to the file as they complete */
+				stream = true;
+				break;
+			case 's':
+				sceneFile = optarg;
+				break;
+			case 'l':
+				/* Test every sphere instead of traversing the BVH */
+				linear = true;
+				break;
+			case 'z':
+				/* zlib compression level, 0 to 9, for .png output */
+				level = atoi(optarg);
+				break;
+			case 'o':
+				/* A .png name is written as PNG, anything else as PPM;
+				 * with -a, a printf pattern for the frame number */
+				filename = optarg;
+				break;
+			case 'k':
+				/* Force a packet kernel: scalar, avx2 or avx512 */
+				if(strcmp(optarg, "scalar") == 0)
+					requested = KERNEL_SCALAR;
+				else if(strcmp(optarg, "avx2") == 0)
+					requested = KERNEL_AVX2;
+				else if(strcmp(optarg, "avx512") == 0)
+					requested = KERNEL_AVX512;
+				break;
+			case 't':
+				if(atoi(optarg) <= 0){
+					fprintf(stderr, "-t needs at least one thread\n");
+					return -1;
+				}
+				omp_set_num_threads(atoi(optarg));
+				break;
+			default:
+				return -1;
+		}
+	}
+	
+	/* A coordinator listens before starting its local workers, which then
+	 * carry on as if run with -W; this is before any parallel region, so
+	 * none of OpenMP's threads are lost in the fork */
+	int listener = -1;
+	if(coordinateAt != NULL){
+		if(stream || animationFile != NULL || benchFile != NULL){
+			fprintf(stderr, "A coordinator renders single images to a file only\n");
+			return -1;
+		}
+		if((listener = listenAt(coordinateAt)) < 0)
+			return -1;
+		int threads = localWorkers > 0 && omp_get_max_threads() > localWorkers ? omp_get_max_threads() / localWorkers : 1;
+		for(i = 0; i < localWorkers; i++){
+			pid_t pid = fork();
+			if(pid < 0){
+				perror("fork");
+				return -1;
+			}
+			if(pid == 0){
+				close(listener);
+				listener = -1;
+				workFor = coordinateAt;
+				coordinateAt = NULL;
+				omp_set_num_threads(threads);
+				break;
+			}
+		}
+	}
+
+	/* Setup is everything before the first tile: loading the scene and
+	 * building the BVH and candidate lists */
+	double started = omp_get_wtime();
+
+	/* Without a scene file, render the original three spheres, and a
+	 * worker renders whatever its coordinator sends */
+	scene sc;
+	int workerFd = -1;
+	if(workFor != NULL){
+		if((workerFd = connectTo(workFor, omp_get_max_threads())) < 0)
+			return -1;
+		if(!receiveScene(workerFd, &sc, TILE_SIZE))
+			return -1;
+	}else if(sceneFile == NULL)
+		defaultScene(&sc);
+	else if(!loadScene(sceneFile, &sc))
+		return -1;
+	animation anim;
+	if(animationFile != NULL){
+		if(stream){
+			fprintf(stderr, "Frames are rendered over the last, so cannot be streamed\n");
+			return -1;
+		}
+		if(filename == NULL)
+			filename = "/tmp/d5chau_frame%04d.ppm";
+		else if(strchr(filename, '%') == NULL){
+			fprintf(stderr, "%s needs a %%d for the frame number\n", filename);
+			return -1;
+		}
+		if(!loadAnimation(animationFile, &sc, &anim))
+			return -1;
+	}else if(filename == NULL)
+		filename = "/tmp/d5chau_image.ppm";
+	
+	/* Primary rays are orthographic along +z, so a row of pixels is a
+	 * perfectly coherent packet */
+	renderer rd;
+	rd.sc = &sc;
+	rd.kernel = selectPacketKernel(requested);
+	rd.packetWidth = packetWidth(rd.kernel);
+	if(requested != KERNEL_AUTO && rd.kernel != requested)
+		fprintf(stderr, "Falling back to the %s kernel\n", packetKernelName(rd.kernel));
+	rd.wave = wave ? malloc(omp_get_max_threads() * sizeof(wavefront)) : NULL;
+	rd.aaGrid = 0;
+	rd.aaThreshold = threshold;
+	rd.stats = calloc(omp_get_max_threads(), sizeof(renderStats));
+	rd.reach = NULL;
+	rd.rowOrder = rowOrder;
+	if(samples > 1){
+		/* The largest grid that fits the budget beside the corners */
+		while(rd.aaGrid < AA_MAX_GRID && 4 + (rd.aaGrid + 1) * (rd.aaGrid + 1) <= samples)
+			rd.aaGrid++;
+		if(rd.aaGrid == 0){
+			fprintf(stderr, "Anti-aliasing needs at least 5 samples\n");
+			return -1;
+		}
+		if(wave){
+			fprintf(stderr, "Anti-aliased pixels are shaded one by one, so -S cannot be used with -w\n");
+			return -1;
+		}
+	}
+
+	/* Tiles are independent, so each is rendered exactly as the serial
+	 * version would; stealing balances the uneven cost of tiles that
+	 * hit spheres against those that do not */
+	int tilesX = (sc.width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (sc.height + TILE_SIZE - 1) / TILE_SIZE;
+	int tile;
+	bool ok = true;
+	double times[3] = {0, 0, 0};
+	if(workFor != NULL){
+		prepareScene(&rd, linear);
+		double rendering = omp_get_wtime();
+		ok = runWorker(&rd, workerFd);
+		close(workerFd);
+		releaseScene(&rd);
+		times[0] = rendering - started;
+		times[1] = omp_get_wtime() - rendering;
+	}else if(coordinateAt != NULL){
+		unsigned char *img = malloc(3*(size_t)sc.width*sc.height*sizeof(unsigned char));
+		double rendering = omp_get_wtime();
+		ok = coordinateTiles(listener, &sc, TILE_SIZE, timeout, img);
+		double writing = omp_get_wtime();
+		if(ok)
+			saveImage(filename, img, sc.width, sc.height, level);
+		free(img);
+		while(wait(NULL) > 0)
+			;
+		times[0] = rendering - started;
+		times[1] = writing - rendering;
+		times[2] = omp_get_wtime() - writing;
+	}else if(animationFile != NULL){
+		times[0] = omp_get_wtime() - started;
+		renderAnimation(&rd, &anim, filename, linear, full, level, times);
+		freeAnimation(&anim);
+	}else if(!stream){
+		prepareScene(&rd, linear);
+		double rendering = omp_get_wtime();
+		/* Will contain the raw image */
+		unsigned char * img = malloc(3*(size_t)sc.width*sc.height*sizeof(unsigned char));
+		int *tiles = malloc(tilesX * tilesY * sizeof(int));
+		for(tile = 0; tile < tilesX * tilesY; tile++)
+			tiles[tile] = tile;
+		renderTiles(&rd, tiles, tilesX * tilesY, img);
+		free(tiles);
+		double writing = omp_get_wtime();
+		saveImage(filename, img, sc.width, sc.height, level);
+		free(img);
+		releaseScene(&rd);
+		times[0] = rendering - started;
+		times[1] = writing - rendering;
+		times[2] = omp_get_wtime() - writing;
+	}else{
+		/* Each row of tiles is a band. Tiles are handed out strictly in
+		 * order, so every tile of the band a blocked thread waits on
+		 * has already been taken by a thread that is not blocked */
+		bandWriter writer;
+		pngImage png;
+		bool isPng = wantsPng(filename);
+		prepareScene(&rd, linear);
+		double rendering = omp_get_wtime();
+		FILE *f = fopen(filename, "w");
+		if(f == NULL){
+			perror(filename);
+			return -1;
+		}
+		if(isPng)
+			ok = startPng(&png, f, sc.width, sc.height, TILE_SIZE, level);
+		else
+			fprintf(f, "P6 %d %d %d\n", sc.width, sc.height, 255);
+		if(!ok || !startBandWriter(&writer, f, sc.width, sc.height, TILE_SIZE, tilesX, SLOTS_PER_THREAD * omp_get_max_threads(),
+				isPng ? encodeBand : NULL, &png)){
+			fprintf(stderr, "Could not start the writer\n");
+			return -1;
+		}
+		#pragma omp parallel for schedule(monotonic:dynamic)
+		for(tile = 0; tile < tilesX * tilesY; tile++){
+			int band = tile / tilesX;
+			unsigned char *rows = acquireBand(&writer, band);
+			renderTile(&rd, (tile % tilesX) * TILE_SIZE, band * TILE_SIZE, rows, band * TILE_SIZE);
+			finishBandPart(&writer, band);
+		}
+
+		/* Most bands are written while rendering; output is only what
+		 * remains once the last tile is done */
+		double writing = omp_get_wtime();
+		ok = stopBandWriter(&writer);
+		if(isPng)
+			ok = finishPng(&png, f) && ok;
+		if(fclose(f) != 0)
+			ok = false;
+		if(!ok)
+			fprintf(stderr, "Failed writing %s\n", filename);
+		releaseScene(&rd);
+		times[0] = rendering - started;
+		times[1] = writing - rendering;
+		times[2] = omp_get_wtime() - writing;
+	}
+
+	if(benchFile != NULL){
+		char mode[64];
+		snprintf(mode, sizeof(mode), "%s+%s+%s+%s", linear ? "linear" : "bvh",
+				rd.aaGrid > 0 ? "adaptive" : wave ? "wavefront" : "pixel",
+				workFor != NULL ? "worker" : animationFile != NULL ? (full ? "frames" : "incremental") : stream ? "stream" : "frame",
+				rowOrder || stream || workFor != NULL ? "rows" : "morton");
+		if(!appendBenchmark(benchFile, sceneFile != NULL ? sceneFile : "default", &rd, mode, times[0], times[1], times[2]))
+			ok = false;
+	}
+	free(rd.wave);
+	free(rd.stats);
+	freeScene(&sc);
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,284 @@
+/* Scenes and the text format they are loaded from.
+ *
+ * The loader reads the whole file with one fread and parses it in place
+ * with strtof, which is several times faster than fscanf for the millions
+ * of numbers in a large generated scene.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scene.h"
+
+/* Most numbers any directive takes */
+#define MAX_FIELDS 6
+
+void defaultScene(scene *sc){
+	sc->width = 800;
+	sc->height = 60000;
+	sc->maxDepth = 15;
+
+	sc->numMaterials = 3;
+	sc->materials = malloc(3 * sizeof(material));
+	material *materials = sc->materials;
+	materials[0].diffuse.red = 1;
+	materials[0].diffuse.green = 0;
+	materials[0].diffuse.blue = 0;
+	materials[0].reflection = 0.2;
+
+	materials[1].diffuse.red = 0;
+	materials[1].diffuse.green = 1;
+	materials[1].diffuse.blue = 0;
+	materials[1].reflection = 0.5;
+
+	materials[2].diffuse.red = 0;
+	materials[2].diffuse.green = 0;
+	materials[2].diffuse.blue = 1;
+	materials[2].reflection = 0.9;
+
+	sc->numSpheres = 3;
+	sc->spheres = malloc(3 * sizeof(sphere));
+	sphere *spheres = sc->spheres;
+	spheres[0].pos.x = 200;
+	spheres[0].pos.y = 300;
+	spheres[0].pos.z = 0;
+	spheres[0].radius = 100;
+	spheres[0].material = 0;
+
+	spheres[1].pos.x = 400;
+	spheres[1].pos.y = 400;
+	spheres[1].pos.z = 0;
+	spheres[1].radius = 100;
+	spheres[1].material = 1;
+
+	spheres[2].pos.x = 500;
+	spheres[2].pos.y = 140;
+	spheres[2].pos.z = 0;
+	spheres[2].radius = 100;
+	spheres[2].material = 2;
+
+	sc->numLights = 3;
+	sc->lights = malloc(3 * sizeof(light));
+	light *lights = sc->lights;
+	lights[0].pos.x = 0;
+	lights[0].pos.y = 240;
+	lights[0].pos.z = -100;
+	lights[0].intensity.red = 1;
+	lights[0].intensity.green = 1;
+	lights[0].intensity.blue = 1;
+
+	lights[1].pos.x = 3200;
+	lights[1].pos.y = 3000;
+	lights[1].pos.z = -1000;
+	lights[1].intensity.red = 0.6;
+	lights[1].intensity.green = 0.7;
+	lights[1].intensity.blue = 1;
+
+	lights[2].pos.x = 600;
+	lights[2].pos.y = 0;
+	lights[2].pos.z = -100;
+	lights[2].intensity.red = 0.3;
+	lights[2].intensity.green = 0.5;
+	lights[2].intensity.blue = 1;
+}
+
+/* Make room for one more element, doubling the array when it is full */
+static void *grow(void *array, int count, int *capacity, size_t size){
+	if(count < *capacity)
+		return array;
+	*capacity = *capacity ? 2 * *capacity : 64;
+	return realloc(array, *capacity * size);
+}
+
+/* Whether the directive at *p is keyword; if so, skip past it */
+static bool directive(char **p, const char *keyword){
+	size_t length = strlen(keyword);
+	if(strncmp(*p, keyword, length) != 0 || ((*p)[length] != ' ' && (*p)[length] != '\t'))
+		return false;
+	*p += length;
+	return true;
+}
+
+bool loadScene(const char *filename, scene *sc){
+	FILE *f = fopen(filename, "rb");
+	if(f == NULL){
+		perror(filename);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *text = malloc(size + 1);
+	if(fread(text, 1, size, f) != (size_t) size){
+		perror(filename);
+		fclose(f);
+		free(text);
+		return false;
+	}
+	fclose(f);
+	text[size] = '\0';
+
+	int sphereCapacity = 0, materialCapacity = 0, lightCapacity = 0;
+	memset(sc, 0, sizeof(scene));
+	sc->maxDepth = 15;
+
+	char *p = text;
+	int line = 0;
+	bool ok = true;
+	while(ok && *p != '\0'){
+		float field[MAX_FIELDS];
+		int numFields = 0, wanted;
+		line++;
+
+		while(*p == ' ' || *p == '\t')
+			p++;
+		if(*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+			wanted = -1;
+		else if(directive(&p, "resolution"))
+			wanted = 2;
+		else if(directive(&p, "depth"))
+			wanted = 1;
+		else if(directive(&p, "material"))
+			wanted = 4;
+		else if(directive(&p, "sphere"))
+			wanted = 5;
+		else if(directive(&p, "light"))
+			wanted = 6;
+		else{
+			fprintf(stderr, "%s:%d: unknown directive\n", filename, line);
+			ok = false;
+			break;
+		}
+
+		/* The numbers, then nothing but a comment up to the newline */
+		while(numFields < wanted){
+			char *end;
+			/* strtof would skip a newline as whitespace */
+			while(*p == ' ' || *p == '\t')
+				p++;
+			if(*p == '\n' || *p == '\r')
+				break;
+			field[numFields] = strtof(p, &end);
+			if(end == p)
+				break;
+			numFields++;
+			p = end;
+		}
+		while(*p == ' ' || *p == '\t' || *p == '\r')
+			p++;
+		if(wanted >= 0 && (numFields < wanted || (*p != '#' && *p != '\n' && *p != '\0'))){
+			fprintf(stderr, "%s:%d: expected %d numbers\n", filename, line, wanted);
+			ok = false;
+			break;
+		}
+		while(*p != '\n' && *p != '\0')
+			p++;
+		if(*p == '\n')
+			p++;
+
+		switch(wanted){
+			case 2:
+				sc->width = (int) field[0];
+				sc->height = (int) field[1];
+				if(sc->width <= 0 || sc->height <= 0 || field[0] != sc->width || field[1] != sc->height){
+					fprintf(stderr, "%s:%d: resolution must be positive integers\n", filename, line);
+					ok = false;
+				}
+				break;
+			case 1:
+				sc->maxDepth = (int) field[0];
+				if(sc->maxDepth < 1){
+					fprintf(stderr, "%s:%d: depth must be at least 1\n", filename, line);
+					ok = false;
+				}
+				break;
+			case 4:{
+				sc->materials = grow(sc->materials, sc->numMaterials, &materialCapacity, sizeof(material));
+				material *m = &sc->materials[sc->numMaterials++];
+				m->diffuse.red = field[0];
+				m->diffuse.green = field[1];
+				m->diffuse.blue = field[2];
+				m->reflection = field[3];
+				break;
+			}
+			case 5:{
+				sc->spheres = grow(sc->spheres, sc->numSpheres, &sphereCapacity, sizeof(sphere));
+				sphere *s = &sc->spheres[sc->numSpheres++];
+				s->pos.x = field[0];
+				s->pos.y = field[1];
+				s->pos.z = field[2];
+				s->radius = field[3];
+				s->material = (int) field[4];
+				if(s->material != field[4] || s->material < 0){
+					fprintf(stderr, "%s:%d: material must be an index\n", filename, line);
+					ok = false;
+				}
+				break;
+			}
+			case 6:{
+				sc->lights = grow(sc->lights, sc->numLights, &lightCapacity, sizeof(light));
+				light *l = &sc->lights[sc->numLights++];
+				l->pos.x = field[0];
+				l->pos.y = field[1];
+				l->pos.z = field[2];
+				l->intensity.red = field[3];
+				l->intensity.green = field[4];
+				l->intensity.blue = field[5];
+				break;
+			}
+		}
+	}
+	free(text);
+
+	/* Materials may follow the spheres that use them */
+	int i;
+	for(i = 0; ok && i < sc->numSpheres; i++){
+		if(sc->spheres[i].material >= sc->numMaterials){
+			fprintf(stderr, "%s: sphere %d uses material %d of %d\n", filename, i, sc->spheres[i].material, sc->numMaterials);
+			ok = false;
+		}
+	}
+	if(ok && sc->width == 0){
+		fprintf(stderr, "%s: no resolution\n", filename);
+		ok = false;
+	}
+	if(!ok)
+		freeScene(sc);
+	return ok;
+}
+
+bool saveScene(const char *filename, scene *sc){
+	FILE *f = fopen(filename, "w");
+	if(f == NULL){
+		perror(filename);
+		return false;
+	}
+	int i;
+
+	/* Nine significant digits read back as the same float */
+	fprintf(f, "resolution %d %d\n", sc->width, sc->height);
+	fprintf(f, "depth %d\n", sc->maxDepth);
+	for(i = 0; i < sc->numMaterials; i++){
+		material *m = &sc->materials[i];
+		fprintf(f, "material %.9g %.9g %.9g %.9g\n", m->diffuse.red, m->diffuse.green, m->diffuse.blue, m->reflection);
+	}
+	for(i = 0; i < sc->numLights; i++){
+		light *l = &sc->lights[i];
+		fprintf(f, "light %.9g %.9g %.9g %.9g %.9g %.9g\n", l->pos.x, l->pos.y, l->pos.z,
+				l->intensity.red, l->intensity.green, l->intensity.blue);
+	}
+	for(i = 0; i < sc->numSpheres; i++){
+		sphere *s = &sc->spheres[i];
+		fprintf(f, "sphere %.9g %.9g %.9g %.9g %d\n", s->pos.x, s->pos.y, s->pos.z, s->radius, s->material);
+	}
+	return fclose(f) == 0;
+}
+
+void freeScene(scene *sc){
+	free(sc->spheres);
+	free(sc->materials);
+	free(sc->lights);
+	sc->spheres = NULL;
+	sc->materials = NULL;
+	sc->lights = NULL;
+}
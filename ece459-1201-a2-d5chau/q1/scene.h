@@ -0,0 +1,42 @@
+/* Scenes and the text format they are loaded from.
+ *
+ * One directive per line; '#' starts a comment. Spheres name a material
+ * by its position among the material lines, counting from 0.
+ *
+ *   resolution <width> <height>
+ *   depth <levels>                       rays traced per pixel, at most
+ *   material <red> <green> <blue> <reflection>
+ *   sphere <x> <y> <z> <radius> <material>
+ *   light <x> <y> <z> <red> <green> <blue>
+ */
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "raytrace.h"
+
+/* Everything a frame is rendered from */
+typedef struct{
+	int width, height;
+	int maxDepth;
+	sphere *spheres;
+	int numSpheres;
+	material *materials;
+	int numMaterials;
+	light *lights;
+	int numLights;
+}scene;
+
+/* The original three-sphere scene at 800 by 60000 */
+void defaultScene(scene *sc);
+
+/* Read a scene file; prints the problem and returns false if it is
+ * malformed */
+bool loadScene(const char *filename, scene *sc);
+
+/* Write a scene file that loads back exactly */
+bool saveScene(const char *filename, scene *sc);
+
+void freeScene(scene *sc);
+
+#endif
@@ -0,0 +1,105 @@
+/* Generate large random scenes for the ray tracer, in the format of scene.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+#include "scene.h"
+
+/* xorshift64*, so a seed gives the same scene everywhere */
+static unsigned long long state;
+
+static float uniform(float lo, float hi){
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	unsigned long long bits = (state * 2685821657736338717ULL) >> 40;
+	return lo + (hi - lo) * (bits / 16777216.0f);
+}
+
+int main(int argc, char *argv[]){
+	char *filename = "scene.txt";
+	scene sc;
+	int numMaterials = 8;
+	int c, i;
+
+	sc.width = 800;
+	sc.height = 60000;
+	sc.maxDepth = 15;
+	sc.numSpheres = 1000;
+	sc.numLights = 3;
+	state = 1;
+	while((c = getopt(argc, argv, "o:n:m:l:w:h:d:s:")) != -1){
+		switch(c){
+			case 'o':
+				filename = optarg;
+				break;
+			case 'n':
+				sc.numSpheres = atoi(optarg);
+				break;
+			case 'm':
+				numMaterials = atoi(optarg);
+				break;
+			case 'l':
+				sc.numLights = atoi(optarg);
+				break;
+			case 'w':
+				sc.width = atoi(optarg);
+				break;
+			case 'h':
+				sc.height = atoi(optarg);
+				break;
+			case 'd':
+				sc.maxDepth = atoi(optarg);
+				break;
+			case 's':
+				state = strtoull(optarg, NULL, 0) | 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-o file] [-n spheres] [-m materials] [-l lights] "
+						"[-w width] [-h height] [-d depth] [-s seed]\n", argv[0]);
+				return -1;
+		}
+	}
+	if(sc.numSpheres < 0 || numMaterials < 1 || sc.numLights < 0 || sc.width < 1 || sc.height < 1 || sc.maxDepth < 1){
+		fprintf(stderr, "Counts and sizes must be positive\n");
+		return -1;
+	}
+	sc.numMaterials = numMaterials;
+
+	sc.materials = malloc(numMaterials * sizeof(material));
+	for(i = 0; i < numMaterials; i++){
+		sc.materials[i].diffuse.red = uniform(0, 1);
+		sc.materials[i].diffuse.green = uniform(0, 1);
+		sc.materials[i].diffuse.blue = uniform(0, 1);
+		sc.materials[i].reflection = uniform(0, 0.9f);
+	}
+
+	/* Lights sit in front of the image plane, spread over the frame */
+	sc.lights = malloc(sc.numLights * sizeof(light));
+	for(i = 0; i < sc.numLights; i++){
+		sc.lights[i].pos.x = uniform(-0.5f, 1.5f) * sc.width;
+		sc.lights[i].pos.y = uniform(-0.5f, 1.5f) * sc.height;
+		sc.lights[i].pos.z = uniform(-1000, -100);
+		sc.lights[i].intensity.red = uniform(0.3f, 1);
+		sc.lights[i].intensity.green = uniform(0.3f, 1);
+		sc.lights[i].intensity.blue = uniform(0.3f, 1);
+	}
+
+	/* Sized so the spheres roughly cover the frame once whatever their
+	 * number, and scattered in depth so they occlude and reflect */
+	float cell = sqrtf((float) sc.width * sc.height / (sc.numSpheres > 0 ? sc.numSpheres : 1));
+	sc.spheres = malloc(sc.numSpheres * sizeof(sphere));
+	for(i = 0; i < sc.numSpheres; i++){
+		sc.spheres[i].pos.x = uniform(0, sc.width);
+		sc.spheres[i].pos.y = uniform(0, sc.height);
+		sc.spheres[i].pos.z = uniform(-2, 2) * cell;
+		sc.spheres[i].radius = uniform(0.2f, 0.6f) * cell;
+		sc.spheres[i].material = (int) uniform(0, numMaterials) % numMaterials;
+	}
+
+	if(!saveScene(filename, &sc))
+		return -1;
+	freeScene(&sc);
+	return 0;
+}
@@ -0,0 +1,97 @@
+/* Per-tile lists of the spheres primary rays can hit.
+ *
+ * A ray through pixel (x, y) meets a sphere when (x - cx)^2 + (y - cy)^2 is
+ * at most r^2, but intersectRaySphere gets there through terms of order
+ * (2000 + cz)^2, whose rounding can admit rays a little outside the disc.
+ * Discs are padded by well over that error, so culling never drops a hit
+ * and the image is unchanged.
+ *
+ * Lists are built in two parallel passes over the spheres: one counts the
+ * entries of each tile, and after a prefix sum the other fills them in.
+ * Their order within a tile varies between runs, which does not matter
+ * because hits are resolved with intersectRaySphereIndexed.
+ */
+
+#include <stdlib.h>
+#include "tilecull.h"
+
+/* Where primary rays start, as in tracePrimaries */
+#define PRIMARY_Z -2000.0f
+
+/* Anti-aliasing samples lie this far from the pixels of their tile */
+#define SAMPLE_SPREAD 0.5f
+
+/* The tiles the padded disc of s covers; false if none */
+static bool footprint(sphere *s, int tileSize, int tilesX, int tilesY, int *tx0, int *tx1, int *ty0, int *ty1){
+	float depth = fabsf(s->pos.z - PRIMARY_Z);
+	float extent = s->radius + SAMPLE_SPREAD + 1.0f + 1e-3f * (depth + s->radius);
+
+	/* Wholly behind the start of every primary ray */
+	if(s->pos.z + extent < PRIMARY_Z)
+		return false;
+	float x0 = floorf((s->pos.x - extent) / tileSize);
+	float x1 = floorf((s->pos.x + extent) / tileSize);
+	float y0 = floorf((s->pos.y - extent) / tileSize);
+	float y1 = floorf((s->pos.y + extent) / tileSize);
+	if(x1 < 0 || y1 < 0 || x0 >= tilesX || y0 >= tilesY)
+		return false;
+	*tx0 = x0 < 0 ? 0 : (int) x0;
+	*ty0 = y0 < 0 ? 0 : (int) y0;
+	*tx1 = x1 >= tilesX ? tilesX - 1 : (int) x1;
+	*ty1 = y1 >= tilesY ? tilesY - 1 : (int) y1;
+	return true;
+}
+
+tileCandidates buildTileCandidates(scene *sc, int tileSize){
+	tileCandidates c;
+	int numTiles, i;
+	c.tileSize = tileSize;
+	c.tilesX = (sc->width + tileSize - 1) / tileSize;
+	c.tilesY = (sc->height + tileSize - 1) / tileSize;
+	numTiles = c.tilesX * c.tilesY;
+	c.start = calloc(numTiles + 1, sizeof(int));
+
+	/* Count into start[tile + 1], so the prefix sum leaves start[tile] */
+	#pragma omp parallel for schedule(dynamic, 256)
+	for(i = 0; i < sc->numSpheres; i++){
+		int tx0, tx1, ty0, ty1, tx, ty;
+		if(!footprint(&sc->spheres[i], tileSize, c.tilesX, c.tilesY, &tx0, &tx1, &ty0, &ty1))
+			continue;
+		for(ty = ty0; ty <= ty1; ty++)
+			for(tx = tx0; tx <= tx1; tx++){
+				#pragma omp atomic
+				c.start[ty * c.tilesX + tx + 1]++;
+			}
+	}
+	for(i = 0; i < numTiles; i++)
+		c.start[i + 1] += c.start[i];
+
+	int *next = malloc(numTiles * sizeof(int));
+	for(i = 0; i < numTiles; i++)
+		next[i] = c.start[i];
+	c.soa = allocSphereArrays(c.start[numTiles]);
+	#pragma omp parallel for schedule(dynamic, 256)
+	for(i = 0; i < sc->numSpheres; i++){
+		sphere *s = &sc->spheres[i];
+		int tx0, tx1, ty0, ty1, tx, ty, slot;
+		if(!footprint(s, tileSize, c.tilesX, c.tilesY, &tx0, &tx1, &ty0, &ty1))
+			continue;
+		for(ty = ty0; ty <= ty1; ty++)
+			for(tx = tx0; tx <= tx1; tx++){
+				#pragma omp atomic capture
+				slot = next[ty * c.tilesX + tx]++;
+				c.soa.x[slot] = s->pos.x;
+				c.soa.y[slot] = s->pos.y;
+				c.soa.z[slot] = s->pos.z;
+				c.soa.radius[slot] = s->radius;
+				c.soa.index[slot] = i;
+			}
+	}
+	free(next);
+	return c;
+}
+
+void freeTileCandidates(tileCandidates *c){
+	free(c->start);
+	freeSphereArrays(&c->soa);
+}
@@ -0,0 +1,26 @@
+/* Per-tile lists of the spheres primary rays can hit.
+ *
+ * Primary rays all start at z = -2000 and travel along +z, so a sphere can
+ * only be hit by pixels inside its disc on screen. Rasterising each disc's
+ * bounding square into tiles leaves most tiles of a sparse scene with no
+ * candidates at all.
+ */
+
+#ifndef TILECULL_H
+#define TILECULL_H
+
+#include "scene.h"
+#include "packet.h"
+
+typedef struct{
+	int tileSize, tilesX, tilesY;
+	int *start;		/* Tile i's candidates are start[i] to start[i + 1] - 1 */
+	sphereArrays soa;	/* Every tile's candidates, tile after tile */
+}tileCandidates;
+
+/* Lists for tiles of tileSize pixels, numbered row by row; builds in
+ * parallel, so call from outside a parallel region */
+tileCandidates buildTileCandidates(scene *sc, int tileSize);
+void freeTileCandidates(tileCandidates *c);
+
+#endif
@@ -0,0 +1,114 @@
+/* Tiles handed out in Z-order with work stealing */
+
+#include <stdlib.h>
+#include "tilesched.h"
+
+typedef struct{
+	unsigned long long key;	/* Bits of x and y interleaved */
+	int tile;
+}mortonTile;
+
+/* The bits of v spread out to every other bit */
+static unsigned long long spreadBits(unsigned int v){
+	unsigned long long x = v;
+	x = (x | x << 16) & 0x0000FFFF0000FFFFULL;
+	x = (x | x << 8) & 0x00FF00FF00FF00FFULL;
+	x = (x | x << 4) & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | x << 2) & 0x3333333333333333ULL;
+	x = (x | x << 1) & 0x5555555555555555ULL;
+	return x;
+}
+
+static int compareMorton(const void *a, const void *b){
+	unsigned long long ka = ((const mortonTile *) a)->key, kb = ((const mortonTile *) b)->key;
+	return ka < kb ? -1 : ka > kb;
+}
+
+bool startTileScheduler(tileScheduler *s, int *tiles, int count, int tilesX, int threads){
+	mortonTile *sorted = malloc((count > 0 ? count : 1) * sizeof(mortonTile));
+	int i;
+	s->numTiles = count;
+	s->order = malloc((count > 0 ? count : 1) * sizeof(int));
+	s->numRanges = threads;
+	s->ranges = malloc(threads * sizeof(tileRange));
+	if(sorted == NULL || s->order == NULL || s->ranges == NULL){
+		free(sorted);
+		free(s->order);
+		free(s->ranges);
+		return false;
+	}
+
+	for(i = 0; i < count; i++){
+		sorted[i].key = spreadBits(tiles[i] % tilesX) | spreadBits(tiles[i] / tilesX) << 1;
+		sorted[i].tile = tiles[i];
+	}
+	qsort(sorted, count, sizeof(mortonTile), compareMorton);
+	for(i = 0; i < count; i++)
+		s->order[i] = sorted[i].tile;
+	free(sorted);
+
+	for(i = 0; i < threads; i++){
+		s->ranges[i].head = (long long) count * i / threads;
+		s->ranges[i].tail = (long long) count * (i + 1) / threads;
+		omp_init_lock(&s->ranges[i].lock);
+	}
+	return true;
+}
+
+bool nextTile(tileScheduler *s, int thread, int *tile){
+	tileRange *own = &s->ranges[thread];
+	omp_set_lock(&own->lock);
+	if(own->head < own->tail){
+		*tile = s->order[own->head++];
+		omp_unset_lock(&own->lock);
+		return true;
+	}
+	omp_unset_lock(&own->lock);
+
+	/* Only one lock is ever held at a time, so thieves cannot deadlock
+	 * on each other. Stolen tiles are out of every stretch until the
+	 * thief publishes them as its own, so another thread may give up
+	 * early, but never while there is a tile nobody holds */
+	while(true){
+		int victim = -1, most = 0, i;
+		for(i = 0; i < s->numRanges; i++){
+			if(i == thread)
+				continue;
+			omp_set_lock(&s->ranges[i].lock);
+			int left = s->ranges[i].tail - s->ranges[i].head;
+			omp_unset_lock(&s->ranges[i].lock);
+			if(left > most){
+				most = left;
+				victim = i;
+			}
+		}
+		if(victim < 0)
+			return false;
+
+		tileRange *r = &s->ranges[victim];
+		omp_set_lock(&r->lock);
+		int left = r->tail - r->head;
+		int start = r->tail - (left + 1) / 2, end = r->tail;
+		if(left > 0)
+			r->tail = start;
+		omp_unset_lock(&r->lock);
+		/* Its owner took the rest in the meantime; look again */
+		if(left <= 0)
+			continue;
+
+		*tile = s->order[start];
+		omp_set_lock(&own->lock);
+		own->head = start + 1;
+		own->tail = end;
+		omp_unset_lock(&own->lock);
+		return true;
+	}
+}
+
+void freeTileScheduler(tileScheduler *s){
+	int i;
+	for(i = 0; i < s->numRanges; i++)
+		omp_destroy_lock(&s->ranges[i].lock);
+	free(s->ranges);
+	free(s->order);
+}
@@ -0,0 +1,45 @@
+/* Tiles handed out in Z-order with work stealing.
+ *
+ * Tiles are sorted along a Morton curve, so tiles near each other in the
+ * order are near each other in the image and share candidate lists, BVH
+ * nodes and the spheres they reflect. Each thread is given its own
+ * contiguous stretch of the curve and works through it from the front.
+ * A thread that runs out takes the back half of the stretch with the most
+ * tiles left, so uneven tiles, such as those under a strong reflector,
+ * are shared out without threads ever leaving their own part of the image
+ * until they must.
+ */
+
+#ifndef TILESCHED_H
+#define TILESCHED_H
+
+#include <stdbool.h>
+#include <omp.h>
+
+/* One thread's stretch of the curve, padded so that threads never share
+ * a line */
+typedef struct{
+	int head, tail;		/* Positions in order not yet taken */
+	omp_lock_t lock;
+	char pad[64];
+}tileRange;
+
+typedef struct{
+	int numTiles;
+	int *order;		/* The tiles in Z-order */
+	int numRanges;
+	tileRange *ranges;	/* One per thread */
+}tileScheduler;
+
+/* Share the count tiles listed, numbered row by row in rows of tilesX,
+ * among threads; false if out of memory */
+bool startTileScheduler(tileScheduler *s, int *tiles, int count, int tilesX, int threads);
+
+/* The next tile for thread in *tile, from the front of its own stretch
+ * or, once that is empty, stolen from the back of another; false when
+ * every tile has been taken */
+bool nextTile(tileScheduler *s, int thread, int *tile);
+
+void freeTileScheduler(tileScheduler *s);
+
+#endif